@@ -0,0 +1,316 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "frontend_agglomerate.h"
+#include "backend/basic_watershed.hpp"
+#include "backend/region_graph.hpp"
+#include "backend/evaluate.hpp"
+#include "synthetic_affinities.hpp"
+
+/**
+ * Times the stages of agglomeration on a synthetic volume (see
+ * synthetic_affinities.hpp): watershed, region graph extraction, merging,
+ * segmentation extraction, and evaluation against the cells the volume was
+ * created from.
+ */
+
+/**
+ * Reset the peak resident set size of this process, such that peakRss()
+ * reports the peak of the following stage only. Only supported on Linux,
+ * elsewhere the peak of the whole process is reported.
+ */
+void
+resetPeakRss() {
+
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	if (clearRefs)
+		clearRefs << "5";
+}
+
+/**
+ * Get the peak resident set size in MB.
+ */
+double
+peakRss() {
+
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return std::stod(line.substr(6))/1024;
+
+#ifndef _WIN32
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss/(1024.0*1024.0);
+#else
+	return usage.ru_maxrss/1024.0;
+#endif
+#else
+	return 0;
+#endif
+}
+
+struct StageResult {
+
+	std::string name;
+	double      seconds;
+	double      items;
+	std::string unit;
+	double      peakRssMb;
+};
+
+class Stage {
+
+public:
+
+	Stage(std::vector<StageResult>& results, const std::string& name) :
+		_results(results),
+		_name(name) {
+
+		resetPeakRss();
+		_start = std::chrono::steady_clock::now();
+	}
+
+	/**
+	 * Finish the stage, with the number of items processed.
+	 */
+	void done(double items, const std::string& unit) {
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		_results.push_back({_name, seconds, items, unit, peakRss()});
+	}
+
+private:
+
+	std::vector<StageResult>& _results;
+	std::string _name;
+	std::chrono::steady_clock::time_point _start;
+};
+
+void
+printUsage() {
+
+	std::cout <<
+		"usage: waterz_benchmark [options]\n"
+		"\n"
+		"  --size Z,Y,X               size of the synthetic volume (default 128,128,128)\n"
+		"  --cell-size S              spacing of the cells in voxels (default 16)\n"
+		"  --noise N                  standard deviation of the affinity noise, the\n"
+		"                             lower, the more fragments (default 0.2)\n"
+		"  --seed S                   random seed of the volume (default 42)\n"
+		"  --threshold T              merge threshold (default 0.5)\n"
+		"  --scoring-function EXPR    scoring function, if compiled with\n"
+		"                             DynamicScoringFunction\n"
+		"  --threads N                threads for the evaluation (default 1)\n"
+		"  --json FILE                append the results as one line of JSON\n"
+		"  --help                     show this message\n";
+}
+
+int run(int argc, char** argv) {
+
+	std::size_t size[3] = {128, 128, 128};
+	double      cellSize = 16;
+	float       noise = 0.2;
+	unsigned    seed = 42;
+	float       threshold = 0.5;
+	std::string scoringFunction;
+	int         numThreads = 1;
+	std::string jsonFile;
+
+	for (int i = 1; i < argc; i++) {
+
+		std::string arg = argv[i];
+
+		if (arg == "--help" || arg == "-h") {
+
+			printUsage();
+			return 0;
+		}
+
+		if (i + 1 == argc)
+			throw std::invalid_argument("missing value for " + arg);
+		std::string value = argv[++i];
+
+		if (arg == "--size") {
+			char comma;
+			std::stringstream stream(value);
+			if (!(stream >> size[0] >> comma >> size[1] >> comma >> size[2]))
+				throw std::invalid_argument("--size has to be Z,Y,X");
+		} else if (arg == "--cell-size")
+			cellSize = std::stod(value);
+		else if (arg == "--noise")
+			noise = std::stof(value);
+		else if (arg == "--seed")
+			seed = std::stoul(value);
+		else if (arg == "--threshold")
+			threshold = std::stof(value);
+		else if (arg == "--scoring-function")
+			scoringFunction = value;
+		else if (arg == "--threads")
+			numThreads = std::stoi(value);
+		else if (arg == "--json")
+			jsonFile = value;
+		else
+			throw std::invalid_argument("unknown option " + arg);
+	}
+
+	if (scoringFunction.empty() && std::is_same<ScoringFunctionType, DynamicScoringFunction<RegionGraphType, ScoreValue>>::value)
+		scoringFunction = "OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>";
+
+	std::vector<StageResult> results;
+	MemoryAccounting memory;
+
+	std::cout << "creating synthetic volume..." << std::endl;
+	SyntheticVolume synthetic = createVoronoiVolume(size[0], size[1], size[2], cellSize, noise, seed);
+	std::size_t numVoxels = synthetic.numVoxels();
+
+	affinity_graph_ref<AffValue> affinities(
+			synthetic.affinities.data(),
+			boost::extents[3][size[0]][size[1]][size[2]]);
+	volume_const_ref<GtID> groundtruth(
+			synthetic.cells.data(),
+			boost::extents[size[0]][size[1]][size[2]]);
+
+	std::vector<SegID> segmentationData(numVoxels);
+	volume_ref<SegID> segmentation(
+			segmentationData.data(),
+			boost::extents[size[0]][size[1]][size[2]]);
+
+	counts_t<std::size_t> sizes;
+	{
+		Stage stage(results, "watershed");
+		watershed(affinities, (AffValue)0.0001, (AffValue)0.9999, segmentation, sizes, &memory);
+		stage.done(numVoxels, "voxels");
+	}
+	std::size_t numFragments = sizes.size() - 1;
+	memory.record("fragment_sizes", allocatedBytes(sizes));
+
+	RegionGraphType regionGraph(sizes.size());
+	std::shared_ptr<StatisticsProviderType> statisticsProvider =
+			createStatisticsProvider(regionGraph, scoringFunction);
+	{
+		Stage stage(results, "region_graph");
+		get_region_graph(affinities, segmentation, numFragments, *statisticsProvider, regionGraph, 1.0, &memory);
+		stage.done(numVoxels, "voxels");
+	}
+	std::size_t numEdges = regionGraph.edges().size();
+
+	ScoringFunctionType scoringFunctionInstance(regionGraph, *statisticsProvider);
+	RegionMergingType regionMerging(regionGraph);
+	RegionMergingVisitor visitor;
+	std::size_t numMerges;
+	{
+		Stage stage(results, "merge");
+		numMerges = regionMerging.mergeUntil(scoringFunctionInstance, *statisticsProvider, threshold, visitor);
+		stage.done(numMerges, "merges");
+	}
+	memory.record("region_merging", regionMerging.memoryUsage());
+	memory.record("edge_queue", regionMerging.queueMemoryUsage());
+
+	{
+		Stage stage(results, "extract_segmentation");
+		regionMerging.extractSegmentation(segmentation);
+		stage.done(numVoxels, "voxels");
+	}
+
+	{
+		Stage stage(results, "evaluate");
+		auto metrics = compare_volumes(groundtruth, segmentation, numThreads);
+		stage.done(numVoxels, "voxels");
+		std::cout
+				<< "Rand split " << std::get<0>(metrics)
+				<< ", Rand merge " << std::get<1>(metrics)
+				<< ", VOI split " << std::get<2>(metrics)
+				<< ", VOI merge " << std::get<3>(metrics) << std::endl;
+	}
+
+	std::printf("\n");
+	std::printf("volume %zux%zux%zu, %zu cells, %zu fragments, %zu edges, %zu merges\n\n",
+			size[0], size[1], size[2],
+			(std::size_t)*std::max_element(synthetic.cells.begin(), synthetic.cells.end()),
+			numFragments, numEdges, numMerges);
+	std::printf("%-22s %10s %21s %14s\n", "stage", "time [s]", "throughput", "peak RSS [MB]");
+	for (const StageResult& result : results)
+		std::printf("%-22s %10.3f %10.3g %-10s %14.1f\n",
+				result.name.c_str(),
+				result.seconds,
+				result.items/result.seconds,
+				(result.unit + "/s").c_str(),
+				result.peakRssMb);
+	std::printf("(region_graph: %.3g edges/s)\n", numEdges/results[1].seconds);
+
+	// compare the accounted peaks with the estimate for the same volume
+	std::vector<ComponentMemory> estimate = estimateMemoryUsage(
+			size[0], size[1], size[2],
+			numFragments,
+			false,
+			true,
+			scoringFunction);
+	std::printf("\n%-22s %14s %14s\n", "component", "peak [MB]", "estimate [MB]");
+	for (const ComponentMemory& estimated : estimate) {
+
+		std::size_t peakBytes = memory.peakTotalBytes();
+		for (const ComponentMemory& accounted : memory.components())
+			if (accounted.component == estimated.component)
+				peakBytes = accounted.peakBytes;
+
+		std::printf("%-22s %14.1f %14.1f\n",
+				estimated.component.c_str(),
+				peakBytes/(1024.0*1024.0),
+				estimated.peakBytes/(1024.0*1024.0));
+	}
+
+	if (!jsonFile.empty()) {
+
+		std::ofstream json(jsonFile, std::ios::app);
+		json
+				<< "{\"size\": [" << size[0] << ", " << size[1] << ", " << size[2] << "]"
+				<< ", \"cell_size\": " << cellSize
+				<< ", \"noise\": " << noise
+				<< ", \"seed\": " << seed
+				<< ", \"threshold\": " << threshold
+				<< ", \"fragments\": " << numFragments
+				<< ", \"edges\": " << numEdges
+				<< ", \"merges\": " << numMerges
+				<< ", \"stages\": {";
+		for (std::size_t i = 0; i < results.size(); i++)
+			json
+					<< (i > 0 ? ", " : "")
+					<< "\"" << results[i].name << "\": {"
+					<< "\"seconds\": " << results[i].seconds
+					<< ", \"" << results[i].unit << "_per_second\": " << results[i].items/results[i].seconds
+					<< ", \"peak_rss_mb\": " << results[i].peakRssMb
+					<< "}";
+		json << "}}" << std::endl;
+
+		if (!json)
+			throw std::runtime_error("can not write " + jsonFile);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+
+	try {
+
+		return run(argc, argv);
+
+	} catch (std::exception& e) {
+
+		std::cerr << "waterz_benchmark: " << e.what() << std::endl;
+		return 1;
+	}
+}
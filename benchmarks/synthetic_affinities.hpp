@@ -0,0 +1,143 @@
+#ifndef WATERZ_SYNTHETIC_AFFINITIES_H__
+#define WATERZ_SYNTHETIC_AFFINITIES_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+/**
+ * A synthetic volume of cells with affinities, see createVoronoiVolume().
+ */
+struct SyntheticVolume {
+
+	std::size_t depth;
+	std::size_t height;
+	std::size_t width;
+
+	// the cell of each voxel, [z][y][x], starting at 1
+	std::vector<uint32_t> cells;
+
+	// the affinities, [3][z][y][x], affinities[d][z][y][x] connects voxel
+	// (z,y,x) with its predecessor along dimension d (as for the watershed)
+	std::vector<float> affinities;
+
+	std::size_t numVoxels() const { return depth*height*width; }
+};
+
+/**
+ * Create a deterministic volume of cells and noisy affinities. Cells are the
+ * Voronoi cells of seeds on a jittered grid with the given spacing (in
+ * voxels), each voxel is assigned to the closest seed of the neighboring grid
+ * cells. The affinities are 0.9 within and 0.1 between cells, plus Gaussian
+ * noise of the given standard deviation, clipped to [0,1].
+ *
+ * The spacing sets the number of cells, the noise the number of watershed
+ * fragments per cell. The same arguments always give the same volume.
+ */
+inline SyntheticVolume
+createVoronoiVolume(
+		std::size_t depth,
+		std::size_t height,
+		std::size_t width,
+		double      cellSize,
+		float       noise,
+		unsigned    seed = 42) {
+
+	SyntheticVolume volume;
+	volume.depth = depth;
+	volume.height = height;
+	volume.width = width;
+
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> jitter(0, 1);
+
+	// one seed per grid cell
+	std::ptrdiff_t grid[3] = {
+		(std::ptrdiff_t)std::ceil(depth/cellSize),
+		(std::ptrdiff_t)std::ceil(height/cellSize),
+		(std::ptrdiff_t)std::ceil(width/cellSize)
+	};
+	std::vector<double> seeds(3*grid[0]*grid[1]*grid[2]);
+	for (std::size_t i = 0; i < seeds.size(); i += 3) {
+
+		std::size_t cell = i/3;
+		std::size_t g[3] = {
+			cell/(grid[1]*grid[2]),
+			(cell/grid[2])%grid[1],
+			cell%grid[2]
+		};
+		for (int d = 0; d < 3; d++)
+			seeds[i + d] = (g[d] + jitter(random))*cellSize;
+	}
+
+	volume.cells.resize(volume.numVoxels());
+	std::size_t i = 0;
+	for (std::size_t z = 0; z < depth; z++)
+		for (std::size_t y = 0; y < height; y++)
+			for (std::size_t x = 0; x < width; x++, i++) {
+
+				double p[3] = { z + 0.5, y + 0.5, x + 0.5 };
+				std::ptrdiff_t g[3];
+				for (int d = 0; d < 3; d++)
+					g[d] = (std::ptrdiff_t)(p[d]/cellSize);
+
+				double minDistance = std::numeric_limits<double>::max();
+				uint32_t closest = 0;
+
+				for (std::ptrdiff_t gz = std::max<std::ptrdiff_t>(g[0] - 1, 0); gz <= std::min(g[0] + 1, grid[0] - 1); gz++)
+				for (std::ptrdiff_t gy = std::max<std::ptrdiff_t>(g[1] - 1, 0); gy <= std::min(g[1] + 1, grid[1] - 1); gy++)
+				for (std::ptrdiff_t gx = std::max<std::ptrdiff_t>(g[2] - 1, 0); gx <= std::min(g[2] + 1, grid[2] - 1); gx++) {
+
+					std::size_t cell = (gz*grid[1] + gy)*grid[2] + gx;
+					const double* s = &seeds[3*cell];
+					double distance =
+							(p[0] - s[0])*(p[0] - s[0]) +
+							(p[1] - s[1])*(p[1] - s[1]) +
+							(p[2] - s[2])*(p[2] - s[2]);
+
+					if (distance < minDistance) {
+
+						minDistance = distance;
+						closest = cell + 1;
+					}
+				}
+
+				volume.cells[i] = closest;
+			}
+
+	std::normal_distribution<float> gaussian(0, noise);
+	std::ptrdiff_t offsets[3] = {
+		(std::ptrdiff_t)(height*width),
+		(std::ptrdiff_t)width,
+		1
+	};
+
+	volume.affinities.resize(3*volume.numVoxels());
+	for (int d = 0; d < 3; d++) {
+
+		i = 0;
+		for (std::size_t z = 0; z < depth; z++)
+			for (std::size_t y = 0; y < height; y++)
+				for (std::size_t x = 0; x < width; x++, i++) {
+
+					std::size_t p[3] = { z, y, x };
+					float affinity = 0;
+
+					if (p[d] > 0) {
+
+						bool same = (volume.cells[i] == volume.cells[i - offsets[d]]);
+						affinity = (same ? 0.9f : 0.1f) + gaussian(random);
+						affinity = std::min(std::max(affinity, 0.0f), 1.0f);
+					}
+
+					volume.affinities[d*volume.numVoxels() + i] = affinity;
+				}
+	}
+
+	return volume;
+}
+
+#endif // WATERZ_SYNTHETIC_AFFINITIES_H__
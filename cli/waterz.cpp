@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "frontend_agglomerate.h"
+#include "backend/Serialization.hpp"
+
+/**
+ * Command line interface to agglomerate raw volumes without Python. Inputs are
+ * read from headerless files in C order (as written by numpy's tofile()),
+ * affinities are memory-mapped.
+ */
+
+void
+printUsage() {
+
+	std::cout <<
+		"usage: waterz --affinities FILE --shape Z,Y,X --thresholds T1[,T2,...] [options]\n"
+		"\n"
+		"Agglomerate an affinity volume and write one segmentation per threshold.\n"
+		"All files are raw arrays in C order, without header.\n"
+		"\n"
+		"  --affinities FILE          affinities of shape [3][Z][Y][X]\n"
+		"  --affinity-type TYPE       float32 (default) or uint8\n"
+		"  --affinity-scale S         scale of uint8 affinities (default 1/255)\n"
+		"  --shape Z,Y,X              size of the volume\n"
+		"  --thresholds T1,T2,...     thresholds to create segmentations for\n"
+		"  --fragments FILE           fragments of shape [Z][Y][X], instead of the\n"
+		"                             initial watershed\n"
+		"  --fragment-type TYPE       uint64 or uint32 (default: segment ID type)\n"
+		"  --groundtruth FILE         uint32 ground-truth of shape [Z][Y][X], to\n"
+		"                             print metrics for each threshold\n"
+		"  --aff-threshold-low L      low threshold of the watershed (default 0.0001)\n"
+		"  --aff-threshold-high H     high threshold of the watershed (default 0.9999)\n"
+		"  --scoring-function EXPR    scoring function, if compiled with\n"
+		"                             DynamicScoringFunction (default\n"
+		"                             'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>')\n"
+		"  --target-num-segments N    stop once N segments are left\n"
+		"  --max-segment-size N       stop once a segment of N voxels was created\n"
+		"  --output PREFIX            write segmentations to PREFIX_<threshold>.raw\n"
+		"                             (segment ID type " << 8*sizeof(SegID) << " bit)\n"
+		"  --merge-history            also write merges to PREFIX_<threshold>_merges.txt,\n"
+		"                             one 'a b c score' per line\n"
+		"  --log-level LEVEL          silent (default), error, warning, info, or debug\n"
+		"  --progress SECONDS         print the progress of each stage to stderr every\n"
+		"                             SECONDS\n"
+		"  --estimate-memory N        print the estimated memory for N fragments and\n"
+		"                             exit, without reading any files\n"
+		"  --help                     show this message\n"
+		"\n"
+		"An interrupt (Ctrl-C) stops merging cleanly, without writing the current\n"
+		"threshold, and exits with status 130.\n";
+}
+
+template <typename T>
+std::vector<T>
+parseList(const std::string& list) {
+
+	std::vector<T> values;
+	std::stringstream stream(list);
+	std::string item;
+
+	while (std::getline(stream, item, ',')) {
+
+		std::stringstream itemStream(item);
+		T value;
+		if (!(itemStream >> value) || !itemStream.eof())
+			throw std::invalid_argument("invalid list '" + list + "'");
+		values.push_back(value);
+	}
+
+	return values;
+}
+
+template <typename T>
+T
+parseValue(const std::string& s) {
+
+	return parseList<T>(s).at(0);
+}
+
+/**
+ * Read a raw file of the given number of elements of type In into a vector of
+ * type Out.
+ */
+template <typename In, typename Out>
+std::vector<Out>
+readVolume(const std::string& filename, std::size_t size) {
+
+	MappedFile file(filename);
+	if (file.size() != size*sizeof(In))
+		throw std::invalid_argument(
+				filename + " has " + std::to_string(file.size()) + " bytes, expected " +
+				std::to_string(size*sizeof(In)));
+
+	const In* data = reinterpret_cast<const In*>(file.data());
+	return std::vector<Out>(data, data + size);
+}
+
+void
+writeRaw(const std::string& filename, const void* data, std::size_t bytes) {
+
+	std::ofstream out(filename, std::ios::binary);
+	out.write(static_cast<const char*>(data), bytes);
+	if (!out)
+		throw std::runtime_error("can not write " + filename);
+}
+
+void
+writeMergeHistory(const std::string& filename, const std::vector<Merge>& merges) {
+
+	std::ofstream out(filename);
+	for (const Merge& merge : merges)
+		out << merge.a << " " << merge.b << " " << merge.c << " " << merge.score << "\n";
+	if (!out)
+		throw std::runtime_error("can not write " + filename);
+}
+
+int
+parseLogLevel(const std::string& level) {
+
+	const char* names[] = { "silent", "error", "warning", "info", "debug" };
+	for (int i = LOG_LEVEL_SILENT; i <= LOG_LEVEL_DEBUG; i++)
+		if (level == names[i])
+			return i;
+
+	throw std::invalid_argument("unknown log level " + level);
+}
+
+void
+printMemory(const std::vector<ComponentMemory>& components) {
+
+	std::printf("%-22s %14s %14s\n", "component", "current [MB]", "peak [MB]");
+	for (const ComponentMemory& memory : components)
+		std::printf("%-22s %14.1f %14.1f\n",
+				memory.component.c_str(),
+				memory.bytes/(1024.0*1024.0),
+				memory.peakBytes/(1024.0*1024.0));
+}
+
+bool
+printProgress(const Progress& progress, void*) {
+
+	if (progress.total)
+		std::fprintf(stderr, "waterz: %s %zu/%zu, %.1fs\n",
+				progress.stage,
+				progress.done,
+				progress.total,
+				progress.seconds);
+	else
+		std::fprintf(stderr, "waterz: %s %zu, min score %g, queue size %zu, %.1fs\n",
+				progress.stage,
+				progress.done,
+				progress.minScore,
+				progress.queueSize,
+				progress.seconds);
+
+	return true;
+}
+
+// the reporter to cancel on SIGINT
+static ProgressReporter* interruptible = NULL;
+
+extern "C" void
+cancelOnInterrupt(int) {
+
+	if (interruptible)
+		interruptible->cancel();
+}
+
+std::string
+thresholdName(float threshold) {
+
+	char name[32];
+	std::snprintf(name, sizeof(name), "%g", threshold);
+	return name;
+}
+
+int run(int argc, char** argv) {
+
+	std::string affinitiesFile;
+	std::string affinityType = "float32";
+	float       affinityScale = 1.0/255;
+	std::vector<std::size_t> shape;
+	std::vector<float> thresholds;
+	std::string fragmentsFile;
+	std::string fragmentType = (sizeof(SegID) == 4 ? "uint32" : "uint64");
+	std::string groundtruthFile;
+	float       affThresholdLow = 0.0001;
+	float       affThresholdHigh = 0.9999;
+	std::string scoringFunction;
+	std::size_t targetNumSegments = 0;
+	std::size_t maxSegmentSize = 0;
+	std::string outputPrefix;
+	bool        writeMerges = false;
+	std::size_t estimateFragments = 0;
+	double      progressInterval = 0;
+
+	for (int i = 1; i < argc; i++) {
+
+		std::string arg = argv[i];
+
+		if (arg == "--help" || arg == "-h") {
+
+			printUsage();
+			return 0;
+		}
+
+		if (arg == "--merge-history") {
+
+			writeMerges = true;
+			continue;
+		}
+
+		if (i + 1 == argc)
+			throw std::invalid_argument("missing value for " + arg);
+		std::string value = argv[++i];
+
+		if (arg == "--affinities")
+			affinitiesFile = value;
+		else if (arg == "--affinity-type")
+			affinityType = value;
+		else if (arg == "--affinity-scale")
+			affinityScale = parseValue<float>(value);
+		else if (arg == "--shape")
+			shape = parseList<std::size_t>(value);
+		else if (arg == "--thresholds")
+			thresholds = parseList<float>(value);
+		else if (arg == "--fragments")
+			fragmentsFile = value;
+		else if (arg == "--fragment-type")
+			fragmentType = value;
+		else if (arg == "--groundtruth")
+			groundtruthFile = value;
+		else if (arg == "--aff-threshold-low")
+			affThresholdLow = parseValue<float>(value);
+		else if (arg == "--aff-threshold-high")
+			affThresholdHigh = parseValue<float>(value);
+		else if (arg == "--scoring-function")
+			scoringFunction = value;
+		else if (arg == "--target-num-segments")
+			targetNumSegments = parseValue<std::size_t>(value);
+		else if (arg == "--max-segment-size")
+			maxSegmentSize = parseValue<std::size_t>(value);
+		else if (arg == "--output")
+			outputPrefix = value;
+		else if (arg == "--log-level")
+			setLogLevel(parseLogLevel(value));
+		else if (arg == "--estimate-memory")
+			estimateFragments = parseValue<std::size_t>(value);
+		else if (arg == "--progress")
+			progressInterval = parseValue<double>(value);
+		else
+			throw std::invalid_argument("unknown option " + arg);
+	}
+
+	// the runtime scoring function needs an expression, compiled ones none
+	if (scoringFunction.empty() && std::is_same<ScoringFunctionType, DynamicScoringFunction<RegionGraphType, ScoreValue>>::value)
+		scoringFunction = "OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>";
+
+	if (estimateFragments > 0 && shape.size() == 3) {
+
+		printMemory(
+				estimateMemoryUsage(
+						shape[0], shape[1], shape[2],
+						estimateFragments,
+						affinityType == "uint8",
+						fragmentsFile.empty(),
+						scoringFunction));
+		return 0;
+	}
+
+	if (affinitiesFile.empty() || shape.size() != 3 || thresholds.empty()) {
+
+		printUsage();
+		return 1;
+	}
+	if (affinityType != "float32" && affinityType != "uint8")
+		throw std::invalid_argument("--affinity-type has to be float32 or uint8");
+	if (fragmentType != "uint32" && fragmentType != "uint64")
+		throw std::invalid_argument("--fragment-type has to be uint32 or uint64");
+	if (writeMerges && outputPrefix.empty())
+		throw std::invalid_argument("--merge-history needs --output");
+
+	std::size_t size = shape[0]*shape[1]*shape[2];
+
+	// static, such that the interrupt handler never sees it destroyed
+	static ProgressReporter progress(
+			(progressInterval > 0 ? printProgress : NULL),
+			NULL,
+			progressInterval);
+	interruptible = &progress;
+	std::signal(SIGINT, cancelOnInterrupt);
+
+	std::vector<SegID> segmentation(size);
+	bool findFragments = fragmentsFile.empty();
+	if (!findFragments) {
+
+		if (fragmentType == "uint32")
+			segmentation = readVolume<uint32_t, SegID>(fragmentsFile, size);
+		else
+			segmentation = readVolume<uint64_t, SegID>(fragmentsFile, size);
+	}
+
+	std::vector<GtID> groundtruth;
+	if (!groundtruthFile.empty())
+		groundtruth = readVolume<GtID, GtID>(groundtruthFile, size);
+	const GtID* groundtruthData = (groundtruth.empty() ? NULL : groundtruth.data());
+
+	WaterzState state;
+	{
+		// the affinities are only needed until the region graph is extracted
+		MappedFile affinities(affinitiesFile);
+		std::size_t valueSize = (affinityType == "uint8" ? 1 : 4);
+		if (affinities.size() != 3*size*valueSize)
+			throw std::invalid_argument(
+					affinitiesFile + " has " + std::to_string(affinities.size()) + " bytes, expected " +
+					std::to_string(3*size*valueSize));
+
+		if (affinityType == "uint8")
+			state = initialize(
+					shape[0], shape[1], shape[2],
+					reinterpret_cast<const QuantizedAffValue*>(affinities.data()),
+					segmentation.data(),
+					groundtruthData,
+					affThresholdLow,
+					affThresholdHigh,
+					affinityScale,
+					findFragments,
+					scoringFunction,
+					&progress);
+		else
+			state = initialize(
+					shape[0], shape[1], shape[2],
+					reinterpret_cast<const AffValue*>(affinities.data()),
+					segmentation.data(),
+					groundtruthData,
+					affThresholdLow,
+					affThresholdHigh,
+					findFragments,
+					scoringFunction,
+					&progress);
+	}
+
+	std::sort(thresholds.begin(), thresholds.end());
+
+	try {
+
+		for (float threshold : thresholds) {
+
+			std::vector<Merge> merges = mergeUntil(state, threshold, targetNumSegments, maxSegmentSize, &progress);
+
+			if (progress.cancelled()) {
+
+				std::cerr
+						<< "waterz: cancelled before threshold " << threshold
+						<< ", after " << merges.size() << " merges" << std::endl;
+				free(state);
+				return 130;
+			}
+
+			MergeStatistics statistics = getMergeStatistics(state);
+			std::cout
+					<< "threshold " << threshold << ": " << merges.size() << " merges"
+					<< ", " << statistics.pops << " pops"
+					<< " (" << statistics.deletedPops << " deleted, " << statistics.stalePops << " stale)"
+					<< ", max degree " << statistics.maxDegree
+					<< ", scoring " << statistics.scoringSeconds << "s"
+					<< ", merging " << statistics.mergingSeconds << "s"
+					<< ", extraction " << statistics.extractionSeconds << "s"
+					<< std::endl;
+			if (groundtruthData)
+				std::cout
+						<< "threshold " << threshold
+						<< ": V_Rand_split " << state.metrics.rand_split
+						<< " V_Rand_merge " << state.metrics.rand_merge
+						<< " V_Info_split " << state.metrics.voi_split
+						<< " V_Info_merge " << state.metrics.voi_merge
+						<< std::endl;
+
+			if (outputPrefix.empty())
+				continue;
+
+			std::string name = outputPrefix + "_" + thresholdName(threshold);
+			writeRaw(name + ".raw", segmentation.data(), size*sizeof(SegID));
+			if (writeMerges)
+				writeMergeHistory(name + "_merges.txt", merges);
+		}
+
+		printMemory(getMemoryUsage(state));
+
+	} catch (...) {
+
+		free(state);
+		throw;
+	}
+
+	free(state);
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+
+	try {
+
+		return run(argc, argv);
+
+	} catch (Cancelled& e) {
+
+		std::cerr << "waterz: cancelled during initialization" << std::endl;
+		return 130;
+
+	} catch (std::exception& e) {
+
+		std::cerr << "waterz: " << e.what() << std::endl;
+		return 1;
+	}
+}
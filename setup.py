@@ -1,8 +1,9 @@
 from setuptools import setup, find_packages
 from setuptools.extension import Extension
 from setuptools.command.build_ext import build_ext as _build_ext
-# from Cython.Build import cythonize
+from Cython.Build import cythonize
 import os
+import shutil
 import builtins
 from pathlib import Path
 
@@ -41,14 +42,86 @@ include_dirs = [
 extensions = [
     Extension(
         'waterz.evaluate',
-        sources=['waterz/evaluate.cpp', 'waterz/frontend_evaluate.cpp'],
+        sources=['waterz/evaluate.pyx', 'waterz/frontend_evaluate.cpp'],
         include_dirs=include_dirs,
         language='c++', 
+        extra_link_args=['-std=c++11', '-pthread'],
+        extra_compile_args=['-std=c++11', '-w', '-pthread', f'-I{conda_prefix}\\Lib\\site-packages\\numpy\\core\\include', f'-I{conda_prefix}\\Library\\include',]),
+    Extension(
+        'waterz.dendrogram',
+        sources=['waterz/dendrogram.pyx'],
+        include_dirs=include_dirs,
+        language='c++',
         extra_link_args=['-std=c++11'],
-        extra_compile_args=['-std=c++11', '-w', f'-I{conda_prefix}\\Lib\\site-packages\\numpy\\core\\include', f'-I{conda_prefix}\\Library\\include',])
+        extra_compile_args=['-std=c++11', '-w', f'-I{conda_prefix}\\Lib\\site-packages\\numpy\\core\\include'])
 ]
 
 
+def prebuilt_extensions():
+    '''
+    Create the agglomeration modules listed in waterz/prebuilt/__init__.py.
+    Each gets its own copy of the sources and of the headers that _get_module()
+    in waterz/__init__.py would generate for it. Set WATERZ_PREBUILT=0 to skip
+    them, all modules are then compiled on first use.
+    '''
+
+    if os.environ.get('WATERZ_PREBUILT', '1') == '0':
+        return []
+
+    # read the list without importing waterz, which is not built yet
+    prebuilt = {}
+    with open(os.path.join(source_dir, 'prebuilt', '__init__.py')) as f:
+        exec(f.read(), prebuilt)
+
+    # the default build profile, the only one prebuilt modules are used for
+    build_profile = {}
+    with open(os.path.join(source_dir, 'build_profile.py')) as f:
+        exec(f.read(), build_profile)
+    profile = build_profile['DEFAULT_PROFILE']
+
+    prebuilt_dir = os.path.join(source_dir, 'prebuilt')
+    modules = []
+
+    for (scoring_function, discretize_queue, segment_id_type), module_name in sorted(prebuilt['PREBUILT'].items()):
+
+        include_dir = os.path.join(prebuilt_dir, module_name)
+        os.makedirs(include_dir, exist_ok=True)
+
+        with open(os.path.join(include_dir, 'ScoringFunction.h'), 'w') as f:
+            f.write('typedef %s ScoringFunctionType;'%scoring_function)
+        with open(os.path.join(include_dir, 'SegID.h'), 'w') as f:
+            f.write('typedef %s_t SegID;'%segment_id_type)
+        with open(os.path.join(include_dir, 'Queue.h'), 'w') as f:
+            if discretize_queue == 0:
+                f.write('template<typename T, typename S> using QueueType = PriorityQueue<T, S>;')
+            else:
+                f.write('template<typename T, typename S> using QueueType = BinQueue<T, S, %d>;'%discretize_queue)
+
+        # cython requires that the pyx file has the same name as the module,
+        # and each module needs its own object file of the frontend
+        shutil.copy(
+            os.path.join(source_dir, 'agglomerate.pyx'),
+            os.path.join(prebuilt_dir, module_name + '.pyx'))
+        shutil.copy(
+            os.path.join(source_dir, 'frontend_agglomerate.cpp'),
+            os.path.join(prebuilt_dir, module_name + '_frontend_agglomerate.cpp'))
+
+        modules.append(
+            Extension(
+                'waterz.prebuilt.' + module_name,
+                sources=[
+                    'waterz/prebuilt/' + module_name + '.pyx',
+                    'waterz/prebuilt/' + module_name + '_frontend_agglomerate.cpp'],
+                include_dirs=[include_dir] + include_dirs,
+                language='c++',
+                extra_link_args=build_profile['link_args'](profile),
+                extra_compile_args=build_profile['compile_args'](profile)))
+
+    return modules
+
+extensions += prebuilt_extensions()
+
+
 setup(
     name='waterz',
     version=VERSION,
@@ -60,7 +133,7 @@ setup(
     author_email='jfunke@iri.upc.edu',
     license='MIT',
     cmdclass={'build_ext': build_ext},
-    setup_requires=['numpy'],
+    setup_requires=['numpy', 'cython'],
     install_requires=['numpy', 'cython'],
     tests_require=['pytest'],
     packages=find_packages(),
@@ -69,7 +142,7 @@ setup(
         'backend': ['*.hpp']
     },
     zip_safe=False,
-    ext_modules=extensions,
+    ext_modules=cythonize(extensions),
     classifiers=[
         "Programming Language :: Python :: 3",
         "Intended Audience :: Developers",
@@ -0,0 +1,130 @@
+import pytest
+import numpy as np
+import waterz as wz
+from math import isclose
+
+
+def make_volume(shape=(16, 16, 16), seed=0):
+    '''
+    A ground-truth of random blocks, and noisy affinities that are high within
+    blocks and low between them.
+    '''
+
+    np.random.seed(seed)
+
+    blocks = np.random.randint(1, 20, size=tuple(s//4 for s in shape))
+    gt = blocks.repeat(4, 0).repeat(4, 1).repeat(4, 2).astype(np.uint32)
+
+    affs = np.zeros((3,) + shape, dtype=np.float32)
+    affs[0, 1:] = gt[1:] == gt[:-1]
+    affs[1, :, 1:] = gt[:, 1:] == gt[:, :-1]
+    affs[2, :, :, 1:] = gt[:, :, 1:] == gt[:, :, :-1]
+    affs = 0.6*affs + 0.4*np.random.random(affs.shape).astype(np.float32)
+
+    return affs, gt
+
+
+def test_incremental_metrics():
+
+    affs, gt = make_volume()
+    thresholds = [0.1, 0.3, 0.5, 0.7, 0.9]
+
+    for segmentation, metrics in wz.agglomerate(affs, thresholds, gt=gt):
+
+        scores = wz.evaluate(segmentation, gt)
+        assert isclose(metrics['V_Rand_split'], scores['rand_split'], rel_tol=1e-6, abs_tol=1e-9)
+        assert isclose(metrics['V_Rand_merge'], scores['rand_merge'], rel_tol=1e-6, abs_tol=1e-9)
+        assert isclose(metrics['V_Info_split'], scores['voi_split'], rel_tol=1e-6, abs_tol=1e-9)
+        assert isclose(metrics['V_Info_merge'], scores['voi_merge'], rel_tol=1e-6, abs_tol=1e-9)
+
+
+def test_checkpoint_resume(tmp_path):
+
+    affs, gt = make_volume()
+    thresholds = [0.2, 0.5, 0.8]
+    checkpoint = str(tmp_path/'checkpoint')
+
+    expected = [
+        (segmentation.copy(), metrics, merge_history)
+        for segmentation, metrics, merge_history in wz.agglomerate(
+            affs, thresholds, gt=gt, return_merge_history=True)
+    ]
+
+    # stop after the first threshold
+    results = wz.agglomerate(
+        affs, thresholds, gt=gt, return_merge_history=True, checkpoint=checkpoint)
+    next(results)
+    results.close()
+
+    # resume, thresholds up to the checkpoint are skipped
+    resumed = wz.agglomerate(
+        affs, thresholds, gt=gt, return_merge_history=True, checkpoint=checkpoint)
+
+    for i, (segmentation, metrics, merge_history) in enumerate(resumed):
+
+        assert np.array_equal(segmentation, expected[i][0])
+        assert metrics == expected[i][1]
+        if i > 0:
+            assert np.array_equal(merge_history, expected[i][2])
+
+
+def test_runtime_scoring_function():
+
+    affs, _ = make_volume()
+    thresholds = [0.3, 0.6]
+
+    for scoring_function in [
+            'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+            'OneMinus<HistogramQuantileAffinity<RegionGraphType, 50, ScoreValue, 256>>']:
+
+        compiled = wz.agglomerate(
+            affs, thresholds,
+            return_merge_history=True,
+            scoring_function=scoring_function,
+            scoring_engine='compiled')
+        runtime = wz.agglomerate(
+            affs, thresholds,
+            return_merge_history=True,
+            scoring_function=scoring_function,
+            scoring_engine='runtime')
+
+        for (_, compiled_merges), (_, runtime_merges) in zip(compiled, runtime):
+
+            assert np.array_equal(compiled_merges[['a', 'b', 'c']], runtime_merges[['a', 'b', 'c']])
+            assert np.allclose(compiled_merges['score'], runtime_merges['score'])
+
+
+def test_checkpoint_mismatch(tmp_path):
+
+    affs, gt = make_volume()
+    checkpoint = str(tmp_path/'checkpoint')
+
+    for _ in wz.agglomerate(affs, [0.5], gt=gt, checkpoint=checkpoint):
+        pass
+
+    with pytest.raises(ValueError):
+        next(wz.agglomerate(affs, [0.3, 0.5], gt=gt, checkpoint=checkpoint))
+
+    other_affs, _ = make_volume(seed=1)
+    with pytest.raises(ValueError):
+        next(wz.agglomerate(other_affs, [0.5], gt=gt, checkpoint=checkpoint))
+
+
+def test_checkpoint_scoring_function_mismatch(tmp_path):
+
+    affs, _ = make_volume()
+    checkpoint = str(tmp_path/'checkpoint')
+
+    for _ in wz.agglomerate(
+            affs, [0.5],
+            scoring_function='OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+            scoring_engine='runtime',
+            checkpoint=checkpoint):
+        pass
+
+    with pytest.raises(ValueError):
+        next(wz.agglomerate(
+            affs, [0.5],
+            scoring_function='OneMinus<MaxAffinity<RegionGraphType, ScoreValue>>',
+            scoring_engine='runtime',
+            checkpoint=checkpoint))
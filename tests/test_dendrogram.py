@@ -0,0 +1,28 @@
+import numpy as np
+import waterz as wz
+
+
+def test_cut_dendrogram():
+
+    dendrogram = np.array(
+        [(1, 2, 0.1), (3, 4, 0.2), (2, 4, 0.3), (5, 4, 0.5)],
+        dtype=np.dtype([
+            ('child', np.uint64),
+            ('parent', np.uint64),
+            ('score', np.float32)], align=True))
+
+    labels = wz.cut_dendrogram(dendrogram, 0.0, 7)
+    assert list(labels) == [0, 1, 2, 3, 4, 5, 6]
+
+    labels = wz.cut_dendrogram(dendrogram, 0.25, 7)
+    assert list(labels) == [0, 2, 2, 4, 4, 5, 6]
+
+    labels = wz.cut_dendrogram(dendrogram, 0.35, 7)
+    assert list(labels) == [0, 4, 4, 4, 4, 5, 6]
+
+    labels = wz.cut_dendrogram(dendrogram, 1.0)
+    assert list(labels) == [0, 4, 4, 4, 4, 4]
+
+    fragments = np.array([[[0, 1], [3, 6]]], dtype=np.uint64)
+    segmentation = wz.cut_dendrogram(dendrogram, 0.25, 7)[fragments]
+    assert segmentation.tolist() == [[[0, 2], [4, 6]]]
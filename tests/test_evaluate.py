@@ -25,3 +25,61 @@ def test_evaluate():
     assert isclose(scores['rand_merge'], 0.8709677419354839)
     assert isclose(scores['voi_split'], 0.22222222222222232)
     assert isclose(scores['voi_merge'], 0.14814814814814792)
+
+
+def test_evaluate_threads():
+    np.random.seed(0)
+
+    # large enough to be split between threads
+    shape = (128, 128, 128)
+    gt = np.random.randint(50, size=shape, dtype=np.uint64)
+    seg = (gt + np.random.randint(2, size=shape, dtype=np.uint64))//2
+
+    scores = wz.evaluate(seg, gt, num_threads=1)
+    scores_threaded = wz.evaluate(seg, gt, num_threads=4)
+
+    for key in ['rand_split', 'rand_merge', 'voi_split', 'voi_merge']:
+        assert isclose(scores[key], scores_threaded[key])
+
+
+def test_evaluate_chunked():
+    np.random.seed(0)
+
+    shape = (20, 30, 40)
+    gt = np.random.randint(50, size=shape, dtype=np.uint64)
+    seg = (gt + np.random.randint(2, size=shape, dtype=np.uint64))//2
+
+    scores = wz.evaluate(seg, gt)
+    scores_chunked = wz.evaluate_chunked(seg, gt, chunk_size=7)
+
+    # chunks of arbitrary shape and non-contiguous memory
+    evaluation = wz.StreamingEvaluation()
+    evaluation.add(seg[:, :, :13], gt[:, :, :13])
+    evaluation.add(seg[:, :, 13:], gt[:, :, 13:])
+    scores_streamed = evaluation.metrics()
+
+    for key in ['rand_split', 'rand_merge', 'voi_split', 'voi_merge']:
+        assert isclose(scores[key], scores_chunked[key])
+        assert isclose(scores[key], scores_streamed[key])
+
+
+def test_evaluate_types_and_views():
+    np.random.seed(0)
+
+    shape = (20, 30, 40)
+    gt = np.random.randint(50, size=shape, dtype=np.uint64)
+    seg = (gt + np.random.randint(2, size=shape, dtype=np.uint64))//2
+
+    gt_view = gt[::2, 5:25, ::-1]
+    seg_view = seg[::2, 5:25, ::-1]
+    scores = wz.evaluate(
+        np.ascontiguousarray(seg_view),
+        np.ascontiguousarray(gt_view))
+
+    for seg_type in [np.uint32, np.uint64]:
+        for gt_type in [np.uint32, np.uint64]:
+            scores_view = wz.evaluate(
+                seg.astype(seg_type)[::2, 5:25, ::-1],
+                gt.astype(gt_type)[::2, 5:25, ::-1])
+            for key in ['rand_split', 'rand_merge', 'voi_split', 'voi_merge']:
+                assert isclose(scores[key], scores_view[key])
@@ -1,8 +1,17 @@
 from __future__ import absolute_import
-from .evaluate import evaluate
+from .evaluate import evaluate, evaluate_chunked, StreamingEvaluation
+from .dendrogram import cut_dendrogram
+from . import build_profile
 
 __version__ = '0.8'
 
+class Cancelled(RuntimeError):
+    '''
+    Raised by agglomerate() and agglomerate_graph() if the progress callback
+    returned False.
+    '''
+    pass
+
 def agglomerate(
         affs,
         thresholds,
@@ -14,6 +23,15 @@ def agglomerate(
         return_region_graph = False,
         scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
         discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = None,
+        affinity_scale = None,
+        target_num_segments = None,
+        max_segment_size = None,
+        checkpoint = None,
+        return_statistics = False,
+        progress = None,
+        progress_interval = 1.0,
         force_rebuild = False):
     '''
     Compute segmentations from an affinity graph for several thresholds.
@@ -22,12 +40,18 @@ def agglomerate(
     be done for you if needed, but you can save memory by making sure your
     volumes are already C_CONTIGUOUS.
 
+    The GIL is released during watershed, region graph extraction, and merging,
+    such that independent agglomerations can run concurrently in Python
+    threads.
+
     Parameters
     ----------
 
-        affs: numpy array, float32, 4 dimensional
+        affs: numpy array, float32 or uint8, 4 dimensional
 
-            The affinities as an array with affs[channel][z][y][x].
+            The affinities as an array with affs[channel][z][y][x]. uint8
+            affinities are used directly (without conversion to float32) and
+            scaled by affinity_scale.
 
         thresholds: list of float32
 
@@ -39,10 +63,11 @@ def agglomerate(
             An optional ground-truth segmentation as an array with gt[z][y][x].
             If given, metrics
 
-        fragments: numpy array, uint64, 3 dimensional (optional)
+        fragments: numpy array, uint64 or uint32, 3 dimensional (optional)
 
             An optional volume of fragments to use, instead of the build-in 
-            zwatershed.
+            zwatershed. Fragments of a different type than segment_id_type will
+            be converted.
 
         aff_threshold_low: float, default 0.0001
         aff_threshold_high: float, default 0.9999,
@@ -76,9 +101,67 @@ def agglomerate(
             If set to non-zero, a bin queue with that many bins will be used to 
             approximate the priority queue for merge operations.
 
+        segment_id_type: string, 'uint64' or 'uint32' (optional)
+
+            The type of fragment and segment IDs. 'uint32' halves the memory
+            used for the segmentation and the region graph, but limits the
+            number of fragments to 2^32-1. If not given, 'uint32' is used if
+            fragments of type uint32 are passed, 'uint64' otherwise.
+
+        affinity_scale: float (optional)
+
+            Only for uint8 affinities: the factor to convert the stored values
+            into affinities, default 1/255. aff_threshold_low and
+            aff_threshold_high refer to the scaled affinities.
+
+        target_num_segments: int (optional)
+
+            Stop merging once only this many segments are left, even if the
+            current threshold was not reached yet. Pass a single threshold
+            larger than all scores (e.g., [1.0] for the default scoring
+            function) to merge until exactly this number of segments in one
+            pass.
+
+        max_segment_size: int (optional)
+
+            Stop merging once a segment of at least this many voxels was
+            created, even if the current threshold was not reached yet.
+
+        checkpoint: str (optional)
+
+            Path to a checkpoint file. After each threshold, the complete state
+            of merging is written to this file. If the file exists already,
+            merging resumes from the saved state instead. The checkpoint has to
+            be created with the same scoring_function, discretize_queue, and
+            segment_id_type, and for the same affs, gt, fragments, thresholds,
+            affinity thresholds and scale, and stopping criteria, otherwise a
+            ValueError is raised. Thresholds below the one of the checkpoint
+            are skipped, but the segmentation is still returned for them.
+
+            The file is kept after the last threshold, such that a repeated
+            call returns all segmentations without merging again. Remove it to
+            start over.
+
+        return_statistics: bool
+
+            If set to True, the returning tuple will contain statistics of the
+            merging for the threshold, to find out where the time is spent.
+
+        scoring_engine: 'compiled' or 'runtime', default 'compiled'
+
+            How to evaluate scoring_function. 'compiled' compiles a module for
+            each scoring function, which gives the fastest merging, but takes a
+            while the first time a scoring function is used. 'runtime' parses
+            scoring_function when called, and evaluates it with a module that
+            is compiled only once for all scoring functions (per
+            discretize_queue and segment_id_type). Scores are computed in
+            float32 throughout. HistogramQuantileAffinity is limited to 256
+            bins, and MeanMaxKAffinity to K <= 8.
+
         force_rebuild:
 
-            Force the rebuild of the module. Only needed for development.
+            Force the rebuild of the module, also if it was prebuilt with the
+            package. Only needed for development.
 
     Returns
     -------
@@ -93,7 +176,8 @@ def agglomerate(
 
         segmentation
 
-            The current segmentation (numpy array, uint64, 3 dimensional).
+            The current segmentation (numpy array, uint64 or uint32 depending
+            on segment_id_type, 3 dimensional).
 
         metrics (only if ground truth was provided)
 
@@ -102,14 +186,66 @@ def agglomerate(
 
         merge_history (only if return_merge_history is True)
 
-            A list of dictionaries with keys 'a', 'b', 'c', and 'score',
+            A numpy structured array with fields 'a', 'b', 'c', and 'score',
             indicating that region a got merged with b into c with the given
             score.
 
         region_graph (only if return_region_graph is True)
 
-            A list of dictionaries with keys 'u', 'v', and 'score', indicating
-            an edge between u and v with the given score.
+            A numpy structured array with fields 'u', 'v', and 'score',
+            indicating an edge between u and v with the given score.
+
+        statistics (only if return_statistics is True)
+
+            A dictionary with the counters and timings of merging from the
+            previous threshold to this one:
+
+                'pops': edges taken from the queue
+                'deleted_pops': popped edges that were deleted already
+                'stale_pops': popped edges that had to be rescored
+                'merges': number of merges
+                'mean_score_delta', 'max_score_delta': increase of the score
+                    of stale edges by rescoring
+                'max_degree': largest number of edges of a merged region
+                'scoring_seconds': initial scoring (first threshold only)
+                'merging_seconds', 'extraction_seconds',
+                'evaluation_seconds': time spent in each phase
+                'stages': list of {'stage', 'seconds', 'resident_mb'} for
+                    each stage since the previous threshold (for the first,
+                    including watershed and region graph extraction), with
+                    the resident memory of the process after the stage
+                'memory': {component: {'bytes', 'peak_bytes'}} for each of
+                    'region_graph', 'statistics_provider', 'edge_queue',
+                    'region_merging', 'fragment_sizes', and the temporary
+                    'watershed_buffer' and 'region_graph_buffer', with the
+                    current and peak bytes since initialization; 'total'
+                    holds their sum (without the passed volumes), see
+                    estimate_memory()
+
+            Many deleted or stale pops relative to merges mean that the queue
+            does a lot of wasted work for the scoring function.
+
+        progress: callable(progress), optional
+
+            Called about every progress_interval seconds (and once after
+            scoring and merging) with a dictionary of:
+
+                'stage': 'watershed', 'region_graph', 'scoring', or 'merging'
+                'done', 'total': voxels (watershed, per pass), sections or
+                    given edges (region_graph) processed of total; merges
+                    since the previous threshold (merging, total is 0)
+                'min_score': score of the last edge taken from the queue
+                'queue_size': number of edges in the queue
+                'seconds': time since the start of the stage
+
+            Return False (or raise) to cancel, which raises Cancelled (or the
+            raised exception) from the generator. Merging stops cleanly, and
+            if checkpoint is given, the state is saved such that the next call
+            resumes from it.
+
+        progress_interval: float, default 1.0
+
+            Seconds between calls of progress.
 
     Examples
     --------
@@ -130,11 +266,736 @@ def agglomerate(
             # ...
     '''
 
+    segment_id_type = _segment_id_type(segment_id_type, fragments)
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild)
+
+    return module.agglomerate(
+        affs,
+        thresholds,
+        gt,
+        fragments,
+        aff_threshold_low,
+        aff_threshold_high,
+        return_merge_history,
+        return_region_graph,
+        affinity_scale,
+        target_num_segments,
+        max_segment_size,
+        checkpoint,
+        return_statistics,
+        scoring_expression=scoring_expression,
+        progress=progress,
+        progress_interval=progress_interval)
+
+def evaluate_thresholds(
+        affs,
+        thresholds,
+        gt,
+        fragments = None,
+        aff_threshold_low  = 0.0001,
+        aff_threshold_high = 0.9999,
+        every_merge = False,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = None,
+        affinity_scale = None,
+        force_rebuild = False):
+    '''
+    Compute the Rand and VOI curve of an agglomeration compared to ground-truth
+    over several thresholds.
+
+    This merges once up to the highest threshold, and updates the metrics with
+    each merge. Segmentations are never extracted, which makes this much faster
+    than agglomerate() for parameter sweeps.
+
+    Parameters
+    ----------
+
+        gt: numpy array, uint32, 3 dimensional
+
+            The ground-truth segmentation as an array with gt[z][y][x].
+
+        every_merge: bool, default False
+
+            If set, the metrics are recorded after every merge up to the
+            highest threshold, instead of only at the given thresholds.
+
+        See agglomerate() for the other parameters.
+
+    Returns
+    -------
+
+        A numpy structured array with fields 'threshold', 'rand_split',
+        'rand_merge', 'voi_split', and 'voi_merge', with one entry per
+        (sorted) threshold. If every_merge is set, there is one entry per
+        merge, and 'threshold' is the score of the merge.
+    '''
+
+    segment_id_type = _segment_id_type(segment_id_type, fragments)
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild)
+
+    return module.evaluate_thresholds(
+        affs,
+        thresholds,
+        gt,
+        fragments,
+        aff_threshold_low,
+        aff_threshold_high,
+        every_merge,
+        affinity_scale,
+        scoring_expression=scoring_expression)
+
+def agglomerate_dendrogram(
+        affs,
+        fragments = None,
+        aff_threshold_low  = 0.0001,
+        aff_threshold_high = 0.9999,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = None,
+        affinity_scale = None,
+        force_rebuild = False):
+    '''
+    Agglomerate until all regions are merged, and get the merges as a
+    dendrogram.
+
+    The dendrogram can be cut at any threshold with cut_dendrogram(), which
+    gives the same segmentation as agglomerate() for this threshold without
+    repeating the agglomeration. Use this to explore many thresholds
+    interactively.
+
+    Parameters
+    ----------
+
+        See agglomerate().
+
+    Returns
+    -------
+
+        A tuple (fragments, dendrogram). fragments is the volume of fragments
+        the agglomeration started from (the passed fragments, or the result of
+        the initial watershed). dendrogram is a numpy structured array with
+        fields 'child', 'parent', and 'score', one entry per merge in merge
+        order, indicating that region child got merged into parent. Scores are
+        non-decreasing, each is the maximum of all merge scores up to this
+        merge.
+
+    Examples
+    --------
+
+        fragments, dendrogram = agglomerate_dendrogram(affs)
+
+        labels = cut_dendrogram(dendrogram, 0.5, fragments.max() + 1)
+        segmentation = labels[fragments]
+    '''
+
+    segment_id_type = _segment_id_type(segment_id_type, fragments)
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild)
+
+    return module.get_dendrogram(
+        affs,
+        fragments,
+        aff_threshold_low,
+        aff_threshold_high,
+        affinity_scale,
+        scoring_expression=scoring_expression)
+
+def agglomerate_graph(
+        u,
+        v,
+        affinities,
+        thresholds,
+        contact_areas = None,
+        node_sizes = None,
+        return_region_graph = False,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = None,
+        target_num_segments = None,
+        max_segment_size = None,
+        return_statistics = False,
+        progress = None,
+        progress_interval = 1.0,
+        force_rebuild = False):
+    '''
+    Agglomerate a precomputed region graph for several thresholds, without a
+    volume.
+
+    Use this if the region graph and its edge statistics are already known,
+    e.g., from a blockwise pipeline, or if the volume does not fit into memory.
+
+    Parameters
+    ----------
+
+        u, v: numpy arrays, uint32 or uint64, 1 dimensional
+
+            The node IDs of the edges, edge i connects u[i] and v[i]. ID 0 is
+            background, edges to it are ignored. Edges given several times
+            (e.g., once per block) are combined.
+
+        affinities: numpy array, float32, 1 dimensional
+
+            The affinity of each edge, i.e., the mean affinity for the default
+            scoring function. Providers for other statistics (e.g., maximum or
+            quantiles) are initialized with this value.
+
+        contact_areas: numpy array, uint64, 1 dimensional (optional)
+
+            The number of voxel-level affinities each edge summarizes. Used to
+            weight affinities when combining edges, and for ContactArea. 1 if
+            not given.
+
+        node_sizes: numpy array, uint64, 1 dimensional (optional)
+
+            The number of voxels of each node, indexed by node ID. Used for
+            max_segment_size and RegionSize. 1 if not given.
+
+        See agglomerate() for the other parameters. For progress, the
+        'region_graph' stage counts the given edges.
+
+    Returns
+    -------
+
+        A generator of merge histories, one per (sorted) threshold, each a numpy
+        structured array with fields 'a', 'b', 'c', and 'score' (see
+        agglomerate()). If return_region_graph or return_statistics is set,
+        tuples of merge history, region graph, and statistics (in that order,
+        see agglomerate()) are returned instead.
+    '''
+
+    segment_id_type = _segment_id_type(segment_id_type, u)
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild)
+
+    return module.agglomerate_graph(
+        u,
+        v,
+        affinities,
+        thresholds,
+        contact_areas,
+        node_sizes,
+        return_region_graph,
+        target_num_segments,
+        max_segment_size,
+        return_statistics,
+        scoring_expression=scoring_expression,
+        progress=progress,
+        progress_interval=progress_interval)
+
+def agglomerate_graph_dendrogram(
+        u,
+        v,
+        affinities,
+        contact_areas = None,
+        node_sizes = None,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = None,
+        force_rebuild = False):
+    '''
+    Agglomerate a precomputed region graph until all regions are merged, and
+    get the merges as a dendrogram.
+
+    Parameters
+    ----------
+
+        See agglomerate_graph().
+
+    Returns
+    -------
+
+        The dendrogram as a numpy structured array with fields 'child',
+        'parent', and 'score' (see agglomerate_dendrogram()).
+    '''
+
+    segment_id_type = _segment_id_type(segment_id_type, u)
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild)
+
+    return module.get_graph_dendrogram(
+        u,
+        v,
+        affinities,
+        contact_areas,
+        node_sizes,
+        scoring_expression=scoring_expression)
+
+def agglomerate_batch(
+        jobs,
+        aff_threshold_low  = 0.0001,
+        aff_threshold_high = 0.9999,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = 'uint64',
+        affinity_scale = None,
+        num_threads = 0,
+        force_rebuild = False):
+    '''
+    Agglomerate many independent blocks on an internal pool of threads.
+
+    Parameters
+    ----------
+
+        jobs: list of tuples (affs, fragments, thresholds)
+
+            One tuple per block, with the affinities, an optional volume of
+            fragments (or None to run the watershed), and the thresholds to
+            compute segmentations for. All blocks have to use the same affinity
+            type.
+
+        num_threads: int, default 0
+
+            The number of worker threads. If 0, one thread per core is used.
+
+        See agglomerate() for the other parameters.
+
+    Returns
+    -------
+
+        A generator of tuples (index, segmentations), yielded in the order in
+        which the jobs complete. index is the position of the job in jobs, and
+        segmentations a numpy array with one segmentation per (sorted)
+        threshold, i.e., of shape (len(thresholds), depth, height, width).
+
+    Examples
+    --------
+
+        jobs = [ (affs, None, [0.1, 0.5]) for affs in blocks ]
+
+        for i, segmentations in agglomerate_batch(jobs):
+            # ...
+    '''
+
+    segment_id_type = _segment_id_type(segment_id_type)
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild)
+
+    return module.agglomerate_batch(
+        jobs,
+        aff_threshold_low,
+        aff_threshold_high,
+        affinity_scale,
+        num_threads,
+        scoring_expression=scoring_expression)
+
+def estimate_memory(
+        shape,
+        num_fragments,
+        affinity_dtype = 'float32',
+        find_fragments = True,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        scoring_engine = 'compiled',
+        segment_id_type = 'uint64',
+        force_rebuild = False):
+    '''
+    Estimate the memory agglomerate() needs for a volume, before running it.
+
+    The number and contact area of edges is predicted from the mean size of
+    the fragments, assuming compact fragments. On noisy synthetic volumes,
+    estimates are within 0.8 to 2 times the measured peaks (see the 'memory'
+    statistics of agglomerate(), or waterz_benchmark).
+
+    Parameters
+    ----------
+
+        shape: tuple of int
+
+            The shape (depth, height, width) of the volume.
+
+        num_fragments: int
+
+            The number of fragments, e.g., from a previous run on a similar
+            volume, or of the fragments that will be passed.
+
+        affinity_dtype: 'float32' or 'uint8'
+
+        find_fragments: bool
+
+            Whether the fragments are found with the watershed, i.e., no
+            fragments are passed.
+
+        scoring_function, discretize_queue, scoring_engine, segment_id_type:
+
+            As for agglomerate(). The module is compiled if needed, to
+            measure the statistics per edge of the scoring function.
+
+    Returns
+    -------
+
+        A dictionary {component: bytes} with the estimated peak of each
+        component, and the estimated peak of the process as 'total'. The
+        volumes passed to agglomerate() are not included.
+    '''
+
+    import numpy
+
+    assert len(shape) == 3, "shape has to be (depth, height, width)"
+    assert str(numpy.dtype(affinity_dtype)) in ['float32', 'uint8'], (
+        "affinity_dtype has to be 'float32' or 'uint8'")
+
+    module, scoring_expression = _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        _segment_id_type(segment_id_type),
+        force_rebuild)
+
+    memory = module.estimate_memory(
+        shape[0], shape[1], shape[2],
+        num_fragments,
+        str(numpy.dtype(affinity_dtype)) == 'uint8',
+        find_fragments,
+        scoring_expression)
+
+    return {
+        component: estimate['peak_bytes']
+        for component, estimate in memory.items()
+    }
+
+def set_build_profile(
+        opt_level = 3,
+        march = 'portable',
+        lto = False,
+        pgo = False):
+    '''
+    Set how agglomeration modules are compiled on first use. The profile is
+    part of the module key, i.e., modules for different profiles are cached
+    separately. This overwrites the environment variable WATERZ_BUILD_PROFILE,
+    which accepts the same options as a comma separated list (e.g.,
+    'native,lto,pgo').
+
+    Parameters
+    ----------
+
+        opt_level: int, default 3
+
+            The optimization level of the compiler, 0 to 3.
+
+        march: 'native' or 'portable', default 'portable'
+
+            'native' optimizes for the CPU of this machine, which makes the
+            module unusable on other CPUs. Modules are cached per CPU model in
+            this case. 'portable' targets the default architecture of the
+            compiler.
+
+        lto: bool, default False
+
+            Use link-time optimization.
+
+        pgo: bool, default False
+
+            Use profile-guided optimization (GCC only). The module is compiled
+            twice, with a synthetic agglomeration in between to collect the
+            profile.
+
+    Modules that were prebuilt with the package are only used for the default
+    profile.
+    '''
+
+    global _build_profile
+
+    profile = {
+        'opt_level': opt_level,
+        'march': march,
+        'lto': lto,
+        'pgo': pgo,
+    }
+    build_profile.check_profile(profile)
+    _build_profile = profile
+
+def get_build_profile():
+    '''
+    Get the build profile set with set_build_profile() or via
+    WATERZ_BUILD_PROFILE, as a dictionary.
+    '''
+
+    if _build_profile is None:
+        return build_profile.get_default_profile()
+    return dict(_build_profile)
+
+# the profile set with set_build_profile()
+_build_profile = None
+
+LOG_LEVELS = ['silent', 'error', 'warning', 'info', 'debug']
+
+def set_log_level(level = 'silent', callback = None):
+    '''
+    Set which diagnostic messages are shown. By default, waterz is silent.
+    Messages below the level are discarded before they are formatted, such
+    that silent runs do not pay for them.
+
+    Parameters
+    ----------
+
+        level: 'silent', 'error', 'warning', 'info', or 'debug'
+
+            'info' reports the progress and the time and resident memory of
+            each stage, 'debug' additionally details of the merge loop.
+
+        callback: callable(level, message), optional
+
+            Receives each message with the name of its level, e.g., to forward
+            to Python's logging module. Might be called from the threads of
+            agglomerate_batch(). If not given, messages are written to stderr.
+    '''
+
+    global _log_settings
+
+    assert level in LOG_LEVELS, "level has to be one of %s"%LOG_LEVELS
+
+    _log_settings = (LOG_LEVELS.index(level), callback)
+
+    from . import evaluate as evaluate_module
+    _apply_log_settings(evaluate_module)
+    for module in set(_modules.values()):
+        _apply_log_settings(module)
+
+# the log level and callback set with set_log_level()
+_log_settings = (0, None)
+
+def _apply_log_settings(module):
+    '''
+    Each compiled module keeps its own log level, pass the current settings to
+    the given one.
+    '''
+
+    level, callback = _log_settings
+
+    if callback is None:
+        module.set_log_level(level)
+    else:
+        module.set_log_level(
+            level,
+            lambda l, message: callback(LOG_LEVELS[l], message))
+
+def _log(level, message):
+
+    import sys
+
+    level_index, callback = _log_settings
+    if LOG_LEVELS.index(level) > level_index:
+        return
+
+    if callback is None:
+        sys.stderr.write("waterz: " + message + "\n")
+    else:
+        callback(level, message)
+
+def _segment_id_type(segment_id_type, ids = None):
+    '''
+    Get the name of the given segment ID type, and check that it is supported.
+    If segment_id_type is None, it is 'uint32' if the given IDs (fragments or
+    node IDs) are uint32, and 'uint64' otherwise.
+    '''
+
+    import numpy
+
+    if segment_id_type is None:
+        if ids is not None and numpy.asarray(ids).dtype == numpy.uint32:
+            segment_id_type = 'uint32'
+        else:
+            segment_id_type = 'uint64'
+    segment_id_type = str(numpy.dtype(segment_id_type))
+    assert segment_id_type in ['uint32', 'uint64'], (
+        "segment_id_type has to be 'uint32' or 'uint64'")
+
+    return segment_id_type
+
+# the scoring function of modules for scoring_engine='runtime'
+_RUNTIME_SCORING_FUNCTION = 'DynamicScoringFunction<RegionGraphType, ScoreValue>'
+
+def _get_scoring_module(
+        scoring_function,
+        scoring_engine,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild):
+    '''
+    Get the agglomeration module for the given scoring engine, and the scoring
+    expression to pass to it (empty for compiled scoring functions).
+    '''
+
+    assert scoring_engine in ['compiled', 'runtime'], (
+        "scoring_engine has to be 'compiled' or 'runtime'")
+
+    if scoring_engine == 'compiled':
+        return _get_module(
+            scoring_function,
+            discretize_queue,
+            segment_id_type,
+            force_rebuild), ''
+
+    return _get_module(
+        _RUNTIME_SCORING_FUNCTION,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild), scoring_function
+
+# modules already imported by _get_module(), by configuration
+_modules = {}
+
+def _get_module(
+        scoring_function,
+        discretize_queue,
+        segment_id_type,
+        force_rebuild):
+    '''
+    Get the agglomeration module for the given scoring function, queue, and
+    segment ID type. Modules built with the package (see waterz/prebuilt) are
+    used if available, unless force_rebuild is set. Otherwise, the module will
+    be compiled if it does not exist yet.
+    '''
+
+    profile = get_build_profile()
+
+    config = scoring_function, discretize_queue, segment_id_type, tuple(sorted(profile.items()))
+    if not force_rebuild and config in _modules:
+        return _modules[config]
+
+    if not force_rebuild and profile == build_profile.DEFAULT_PROFILE:
+        from .prebuilt import find_module
+        module = find_module(scoring_function, discretize_queue, segment_id_type)
+        if module is not None:
+            _apply_log_settings(module)
+            _modules[config] = module
+            return module
+
+    module = _compile_module(
+        scoring_function,
+        discretize_queue,
+        segment_id_type,
+        profile,
+        force_rebuild)
+    _apply_log_settings(module)
+    _modules[config] = module
+
+    return module
+
+def _get_source_hash(source_dir, lib_dir):
+    '''
+    Get a hash of the sources a module is compiled from.
+
+    The hash is stored in an index in lib_dir, together with the modification
+    time and size of each source file. Sources are only read and hashed again
+    if one of those changed.
+    '''
+
+    import os
+    import glob
+    import json
+    import hashlib
+
+    source_files = [
+            os.path.join(source_dir, 'agglomerate.pyx'),
+            os.path.join(source_dir, 'frontend_agglomerate.h'),
+            os.path.join(source_dir, 'frontend_agglomerate.cpp')
+    ]
+    source_files += glob.glob(source_dir + '/backend/*.hpp')
+    source_files.sort()
+
+    stamps = [ [f, os.stat(f).st_mtime_ns, os.stat(f).st_size] for f in source_files ]
+
+    index_file = os.path.join(lib_dir, 'waterz_index.json')
+    try:
+        with open(index_file, 'r') as f:
+            index = json.load(f)
+    except (OSError, ValueError):
+        index = {}
+
+    entry = index.get(source_dir)
+    if entry is not None and entry['stamps'] == stamps:
+        return entry['hash']
+
+    source_files_hashes = [ hashlib.md5(open(f, 'r').read().encode('utf-8')).hexdigest() for f in source_files ]
+    source_hash = hashlib.md5(str(source_files_hashes).encode('utf-8')).hexdigest()
+
+    # write to a temporary file first, such that concurrent readers never see
+    # a partial index
+    index[source_dir] = { 'stamps': stamps, 'hash': source_hash }
+    tmp_file = index_file + '.%d.tmp'%os.getpid()
+    try:
+        with open(tmp_file, 'w') as f:
+            json.dump(index, f)
+        os.replace(tmp_file, index_file)
+    except OSError:
+        pass
+
+    return source_hash
+
+def _lock(lock_file):
+    '''
+    Block until the exclusive lock on the given open file is acquired. The lock
+    is released when the file is closed.
+    '''
+
+    try:
+        import fcntl
+        fcntl.flock(lock_file.fileno(), fcntl.LOCK_EX)
+    except ImportError:
+        import msvcrt
+        # LK_LOCK gives up after 10 seconds, keep trying
+        while True:
+            try:
+                msvcrt.locking(lock_file.fileno(), msvcrt.LK_LOCK, 1)
+                break
+            except OSError:
+                pass
+
+def _compile_module(
+        scoring_function,
+        discretize_queue,
+        segment_id_type,
+        profile,
+        force_rebuild):
+    '''
+    Import the agglomeration module for the given configuration and build
+    profile from ~/.cython/inline, and compile it first if needed. Concurrent
+    processes wait for each other, such that each module is only compiled once.
+    '''
+
     import sys, os
     import shutil
-    import glob
+    import importlib
     import numpy
-    #import fcntl
 
     try:
         import hashlib
@@ -152,17 +1013,6 @@ def agglomerate(
     # compile agglomerate.pyx for given scoring function
 
     source_dir = os.path.dirname(os.path.abspath(__file__))
-    source_files = [
-            os.path.join(source_dir, 'agglomerate.pyx'),
-            os.path.join(source_dir, 'frontend_agglomerate.h'),
-            os.path.join(source_dir, 'frontend_agglomerate.cpp')
-    ]
-    source_files += glob.glob(source_dir + '/backend/*.hpp')
-    source_files.sort()
-    source_files_hashes = [ hashlib.md5(open(f, 'r').read().encode('utf-8')).hexdigest() for f in source_files ]
-
-    key = scoring_function, discretize_queue, source_files_hashes, sys.version_info, sys.executable, Cython.__version__
-    module_name = 'waterz_' + hashlib.md5(str(key).encode('utf-8')).hexdigest()
     lib_dir=os.path.expanduser('~/.cython/inline')
 
     # since this could be called concurrently, there is no good way to check
@@ -172,24 +1022,41 @@ def agglomerate(
     except:
         pass
 
+    if lib_dir not in sys.path:
+        sys.path.append(lib_dir)
+
+    source_hash = _get_source_hash(source_dir, lib_dir)
+
+    key = scoring_function, discretize_queue, segment_id_type, build_profile.cache_key(profile), source_hash, sys.version_info, sys.executable, Cython.__version__
+    module_name = 'waterz_' + hashlib.md5(str(key).encode('utf-8')).hexdigest()
+
+    # without a lock, if the module exists already (modules are moved into
+    # lib_dir only once they are complete, see below)
+    if not force_rebuild:
+        try:
+            return importlib.import_module(module_name)
+        except ImportError:
+            pass
+
     # make sure the same module is not build concurrently
     with open(os.path.join(lib_dir, module_name + '.lock'), 'w') as lock_file:
-        #fcntl.lockf(lock_file, fcntl.LOCK_EX)
+        _lock(lock_file)
 
         try:
 
-            if lib_dir not in sys.path:
-                sys.path.append(lib_dir)
             if force_rebuild:
                 raise ImportError
-            else:
-                __import__(module_name)
 
-            print("Re-using already compiled waterz version")
+            # another process might have compiled the module while we were
+            # waiting for the lock
+            importlib.invalidate_caches()
+            importlib.import_module(module_name)
+
+            _log('debug', "Re-using already compiled waterz version")
 
         except ImportError:
 
-            print("Compiling waterz in " + str(lib_dir))
+            _log('info', "Compiling waterz in " + str(lib_dir))
 
             cython_include_dirs = ['.']
             ctx = Context(cython_include_dirs, default_options)
@@ -210,6 +1077,10 @@ def agglomerate(
             with open(scoring_function_header, 'w') as f:
                 f.write('typedef %s ScoringFunctionType;'%scoring_function)
 
+            seg_id_header = os.path.join(include_dir, 'SegID.h')
+            with open(seg_id_header, 'w') as f:
+                f.write('typedef %s_t SegID;'%segment_id_type)
+
             queue_header = os.path.join(include_dir, 'Queue.h')
             with open(queue_header, 'w') as f:
                 if discretize_queue == 0:
@@ -233,6 +1104,9 @@ def agglomerate(
             if "CFLAGS" in cfg_vars:
                 cfg_vars["CFLAGS"] = cfg_vars["CFLAGS"].replace("-Wstrict-prototypes", "")
 
+            compile_args = build_profile.compile_args(profile)
+            link_args = build_profile.link_args(profile)
+
             extension = Extension(
                     module_name,
                     sources = [
@@ -241,22 +1115,127 @@ def agglomerate(
                     ],
                     include_dirs=include_dirs,
                     language='c++',
-                    extra_link_args=['-std=c++11'],
-                    extra_compile_args=['-std=c++11', '-w']
+                    extra_link_args=link_args,
+                    extra_compile_args=compile_args
             )
-            build_extension = build_ext(Distribution())
-            build_extension.finalize_options()
-            build_extension.extensions = cythonize([extension], quiet=True, nthreads=2)
-            build_extension.build_temp = lib_dir
-            build_extension.build_lib  = lib_dir
-            build_extension.run()
-
-    return __import__(module_name).agglomerate(
-        affs,
-        thresholds,
-        gt,
-        fragments,
-        aff_threshold_low,
-        aff_threshold_high,
-        return_merge_history,
-        return_region_graph)
+            extensions = cythonize([extension], quiet=True, nthreads=2)
+
+            def build(build_lib, extra_compile_args, extra_link_args):
+
+                for e in extensions:
+                    e.extra_compile_args = compile_args + extra_compile_args
+                    e.extra_link_args = link_args + extra_link_args
+
+                build_extension = build_ext(Distribution())
+                build_extension.finalize_options()
+                build_extension.extensions = extensions
+                build_extension.build_temp = lib_dir
+                build_extension.build_lib  = build_lib
+                build_extension.force = True
+                build_extension.run()
+
+                return build_extension.get_ext_fullpath(module_name)
+
+            # link into a directory of this process, and move the finished
+            # module into lib_dir, such that processes importing it without
+            # the lock never see a partially written file
+            staging_dir = os.path.join(lib_dir, module_name + '_staging_%d'%os.getpid())
+
+            if profile['pgo']:
+
+                # the instrumented module has the same name and object files
+                # (in build_temp), such that the profile is found by the
+                # second build
+                training_dir = os.path.join(lib_dir, module_name + '_training')
+                build(training_dir, ['-fprofile-generate'], ['-fprofile-generate'])
+                _run_pgo_training(module_name, training_dir, scoring_function)
+                module_file = build(staging_dir, ['-fprofile-use', '-fprofile-correction'], ['-fprofile-use'])
+                shutil.rmtree(training_dir, ignore_errors=True)
+
+            else:
+
+                module_file = build(staging_dir, [], [])
+
+            os.replace(module_file, os.path.join(lib_dir, os.path.basename(module_file)))
+            shutil.rmtree(staging_dir, ignore_errors=True)
+            importlib.invalidate_caches()
+
+    return __import__(module_name)
+
+def _run_pgo_training(module_name, module_dir, scoring_function):
+    '''
+    Run _pgo_training() with the instrumented module in module_dir. This needs
+    a separate process, since the profile is written when the process exits.
+    '''
+
+    import os
+    import sys
+    import subprocess
+
+    package_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    script = '\n'.join([
+        'import sys',
+        'sys.path.insert(0, %r)'%module_dir,
+        'sys.path.insert(0, %r)'%package_dir,
+        'import waterz',
+        'import %s as module'%module_name,
+        'waterz._pgo_training(module, %r)'%scoring_function,
+    ])
+
+    _log('info', "Collecting profile for waterz module")
+    subprocess.check_call([sys.executable, '-c', script])
+
+def _pgo_training(module, scoring_function, size = 64, num_regions = 100):
+    '''
+    Agglomerate a synthetic volume with the given module, to collect a profile
+    for profile-guided optimization.
+
+    The volume consists of Voronoi cells of random seeds. Affinities are high
+    inside cells and low between them, with noise, such that the watershed
+    gives many fragments per cell.
+    '''
+
+    import numpy
+
+    random = numpy.random.RandomState(42)
+
+    # label each voxel with its closest seed
+    z, y, x = numpy.meshgrid(*([numpy.arange(size, dtype=numpy.float32)]*3), indexing='ij')
+    seeds = random.uniform(0, size, size=(num_regions, 3)).astype(numpy.float32)
+    distances = numpy.full((size, size, size), numpy.inf, dtype=numpy.float32)
+    cells = numpy.zeros((size, size, size), dtype=numpy.uint32)
+    for i, (sz, sy, sx) in enumerate(seeds):
+        d = (z - sz)**2 + (y - sy)**2 + (x - sx)**2
+        closer = d < distances
+        distances[closer] = d[closer]
+        cells[closer] = i + 1
+
+    affs = numpy.zeros((3, size, size, size), dtype=numpy.float32)
+    affs[0,1:] = cells[1:] == cells[:-1]
+    affs[1,:,1:] = cells[:,1:] == cells[:,:-1]
+    affs[2,:,:,1:] = cells[:,:,1:] == cells[:,:,:-1]
+    affs = 0.1 + 0.8*affs + random.normal(0, 0.2, size=affs.shape).astype(numpy.float32)
+    affs = numpy.clip(affs, 0, 1).astype(numpy.float32)
+
+    if scoring_function == _RUNTIME_SCORING_FUNCTION:
+        scoring_expression = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>'
+    else:
+        scoring_expression = ''
+
+    thresholds = [0.1, 0.3, 0.5, 0.7, 0.9]
+    for _ in module.agglomerate(
+            affs,
+            thresholds,
+            cells,
+            None,
+            0.0001,
+            0.9999,
+            True,
+            True,
+            None,
+            None,
+            None,
+            None,
+            scoring_expression=scoring_expression):
+        pass
@@ -1,6 +1,9 @@
 from libcpp.vector cimport vector
-from libc.stdint cimport uint64_t, uint32_t
+from libc.stdint cimport uint64_t, uint32_t, uint8_t
 from libcpp cimport bool
+from libcpp.string cimport string
+import os
+import hashlib
 import numpy as np
 cimport numpy as np
 
@@ -12,91 +15,946 @@ def agglomerate(
         aff_threshold_low=0.0001,
         aff_threshold_high=0.9999,
         return_merge_history=False,
-        return_region_graph=False):
+        return_region_graph=False,
+        affinity_scale=None,
+        target_num_segments=None,
+        max_segment_size=None,
+        checkpoint=None,
+        return_statistics=False,
+        scoring_expression='',
+        progress=None,
+        progress_interval=1.0):
+
+    cdef WaterzState state
+    cdef _ProgressReporter reporter = __progress_reporter(progress, progress_interval)
+
+    if checkpoint is not None:
+        checkpoint_info = __expected_checkpoint_info(
+            affs,
+            fragments,
+            gt,
+            thresholds,
+            aff_threshold_low,
+            aff_threshold_high,
+            affinity_scale,
+            target_num_segments or 0,
+            max_segment_size or 0,
+            scoring_expression)
+
+    if checkpoint is not None and os.path.exists(checkpoint):
+
+        __log(LOG_LEVEL_INFO, "Restoring from checkpoint %s..."%checkpoint)
+        volume_shape, has_gt = __checkpoint_info(checkpoint)
+        segmentation = np.zeros(volume_shape, dtype=np.dtype('uint%d'%(8*sizeof(SegID))))
+        state = __load_checkpoint(checkpoint, segmentation, checkpoint_info)
+
+    else:
+
+        affs, gt, segmentation, find_fragments = __prepare_volumes(affs, gt, fragments)
+        try:
+            state = __initialize(affs, segmentation, gt, aff_threshold_low, aff_threshold_high, affinity_scale, find_fragments, scoring_expression, reporter)
+        except RuntimeError:
+            __raise_if_cancelled(reporter)
+            raise
+        has_gt = gt is not None
+
+    try:
+
+        thresholds.sort()
+        for threshold in thresholds:
+
+            merge_history = __merge_until(
+                state,
+                threshold,
+                target_num_segments or 0,
+                max_segment_size or 0,
+                __reporter_ptr(reporter))
+
+            # a cancelled state is consistent, and can be resumed from
+            if checkpoint is not None:
+                __save_checkpoint(state, checkpoint, checkpoint_info['arguments'])
+
+            __raise_if_cancelled(reporter)
+
+            result = (segmentation,)
+
+            if has_gt:
+
+                stats = {}
+                stats['V_Rand_split'] = state.metrics.rand_split
+                stats['V_Rand_merge'] = state.metrics.rand_merge
+                stats['V_Info_split'] = state.metrics.voi_split
+                stats['V_Info_merge'] = state.metrics.voi_merge
+
+                result += (stats,)
+
+            if return_merge_history:
+
+                result += (merge_history,)
+
+            if return_region_graph:
+
+                result += (__get_region_graph(state),)
+
+            if return_statistics:
+
+                result += (__get_merge_statistics(state),)
+
+            if len(result) == 1:
+                yield result[0]
+            else:
+                yield result
+
+    finally:
+        with nogil:
+            free(state)
+
+def evaluate_thresholds(
+        affs,
+        thresholds,
+        gt,
+        fragments=None,
+        aff_threshold_low=0.0001,
+        aff_threshold_high=0.9999,
+        every_merge=False,
+        affinity_scale=None,
+        scoring_expression=''):
+
+    affs, gt, segmentation, find_fragments = __prepare_volumes(affs, gt, fragments)
+
+    cdef WaterzState state = __initialize(affs, segmentation, gt, aff_threshold_low, aff_threshold_high, affinity_scale, find_fragments, scoring_expression)
+    cdef vector[float] sorted_thresholds = sorted(thresholds)
+    cdef bool merges = every_merge
+    cdef _VectorBuffer buffer = _VectorBuffer()
+    cdef vector[CurvePoint] curve
+
+    try:
+        with nogil:
+            curve = getMetricsCurve(state, sorted_thresholds, merges)
+    finally:
+        with nogil:
+            free(state)
+
+    if curve.empty():
+        return np.zeros((0,), dtype=__curve_point_dtype())
+
+    buffer.curve.swap(curve)
+    buffer.expose(&buffer.curve[0], buffer.curve.size()*sizeof(CurvePoint))
+    return np.frombuffer(buffer, dtype=__curve_point_dtype())
+
+def get_dendrogram(
+        affs,
+        fragments=None,
+        aff_threshold_low=0.0001,
+        aff_threshold_high=0.9999,
+        affinity_scale=None,
+        scoring_expression=''):
+
+    affs, _, segmentation, find_fragments = __prepare_volumes(affs, None, fragments)
+
+    cdef WaterzState state = __initialize(affs, segmentation, None, aff_threshold_low, aff_threshold_high, affinity_scale, find_fragments, scoring_expression)
+    cdef _VectorBuffer buffer = _VectorBuffer()
+    cdef vector[DendrogramEntry] dendrogram
+
+    try:
+        with nogil:
+            dendrogram = getDendrogram(state)
+    finally:
+        with nogil:
+            free(state)
+
+    if dendrogram.empty():
+        return segmentation, np.zeros((0,), dtype=__dendrogram_dtype())
+
+    buffer.dendrogram.swap(dendrogram)
+    buffer.expose(&buffer.dendrogram[0], buffer.dendrogram.size()*sizeof(DendrogramEntry))
+    return segmentation, np.frombuffer(buffer, dtype=__dendrogram_dtype())
+
+def agglomerate_graph(
+        u,
+        v,
+        affinities,
+        thresholds,
+        contact_areas=None,
+        node_sizes=None,
+        return_region_graph=False,
+        target_num_segments=None,
+        max_segment_size=None,
+        return_statistics=False,
+        scoring_expression='',
+        progress=None,
+        progress_interval=1.0):
+
+    cdef WaterzState state
+    cdef _ProgressReporter reporter = __progress_reporter(progress, progress_interval)
+
+    try:
+        state = __initialize_from_graph(u, v, affinities, contact_areas, node_sizes, scoring_expression, reporter)
+    except RuntimeError:
+        __raise_if_cancelled(reporter)
+        raise
+
+    try:
+
+        for threshold in sorted(thresholds):
+
+            merge_history = __merge_until(
+                state,
+                threshold,
+                target_num_segments or 0,
+                max_segment_size or 0,
+                __reporter_ptr(reporter))
+
+            __raise_if_cancelled(reporter)
+
+            result = (merge_history,)
+
+            if return_region_graph:
+                result += (__get_region_graph(state),)
+
+            if return_statistics:
+                result += (__get_merge_statistics(state),)
+
+            if len(result) == 1:
+                yield result[0]
+            else:
+                yield result
+
+    finally:
+        with nogil:
+            free(state)
+
+def get_graph_dendrogram(
+        u,
+        v,
+        affinities,
+        contact_areas=None,
+        node_sizes=None,
+        scoring_expression=''):
+
+    cdef WaterzState state = __initialize_from_graph(u, v, affinities, contact_areas, node_sizes, scoring_expression)
+    cdef _VectorBuffer buffer = _VectorBuffer()
+    cdef vector[DendrogramEntry] dendrogram
+
+    try:
+        with nogil:
+            dendrogram = getDendrogram(state)
+    finally:
+        with nogil:
+            free(state)
+
+    if dendrogram.empty():
+        return np.zeros((0,), dtype=__dendrogram_dtype())
+
+    buffer.dendrogram.swap(dendrogram)
+    buffer.expose(&buffer.dendrogram[0], buffer.dendrogram.size()*sizeof(DendrogramEntry))
+    return np.frombuffer(buffer, dtype=__dendrogram_dtype())
+
+def __prepare_volumes(affs, gt, fragments):
 
     # the C++ part assumes contiguous memory, make sure we have it (and do 
     # nothing, if we do)
     if not affs.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous affinity arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        __log(LOG_LEVEL_WARNING, "Creating memory-contiguous affinity arrray (avoid this by passing C_CONTIGUOUS arrays)")
         affs = np.ascontiguousarray(affs)
     if gt is not None and not gt.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        __log(LOG_LEVEL_WARNING, "Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
         gt = np.ascontiguousarray(gt)
     if fragments is not None and not fragments.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous fragments arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        __log(LOG_LEVEL_WARNING, "Creating memory-contiguous fragments arrray (avoid this by passing C_CONTIGUOUS arrays)")
         fragments = np.ascontiguousarray(fragments)
 
-    print("Preparing segmentation volume...")
+    __log(LOG_LEVEL_DEBUG, "Preparing segmentation volume...")
+
+    # the width of fragment and segment IDs this module was compiled for
+    seg_dtype = np.dtype('uint%d'%(8*sizeof(SegID)))
 
     if fragments is None:
         volume_shape = (affs.shape[1], affs.shape[2], affs.shape[3])
-        segmentation = np.zeros(volume_shape, dtype=np.uint64)
+        segmentation = np.zeros(volume_shape, dtype=seg_dtype)
         find_fragments = True
     else:
+        if fragments.dtype != seg_dtype:
+            __log(LOG_LEVEL_WARNING, "Converting fragments to %s (avoid this by passing fragments of the same type as segment_id_type)"%seg_dtype)
+            fragments = fragments.astype(seg_dtype)
         segmentation = fragments
         find_fragments = False
 
-    cdef WaterzState state = __initialize(affs, segmentation, gt, aff_threshold_low, aff_threshold_high, find_fragments)
+    return affs, gt, segmentation, find_fragments
+
+def agglomerate_batch(
+        jobs,
+        aff_threshold_low=0.0001,
+        aff_threshold_high=0.9999,
+        affinity_scale=None,
+        num_threads=0,
+        scoring_expression=''):
+
+    cdef BatchAgglomeration* batch = new BatchAgglomeration(scoring_expression.encode())
+    cdef int threads = num_threads
+    cdef int job
+
+    if affinity_scale is None:
+        affinity_scale = 1.0/255
+
+    # keep references to all arrays the batch is working on
+    arrays = []
+    segmentations = []
+
+    try:
+
+        for affs, fragments, thresholds in jobs:
+            segmentations.append(
+                __add_job(
+                    batch,
+                    affs,
+                    fragments,
+                    thresholds,
+                    aff_threshold_low,
+                    aff_threshold_high,
+                    affinity_scale,
+                    arrays))
+
+        # if starting a worker fails, the finally below joins the others
+        batch.start(threads)
+
+        while True:
+
+            with nogil:
+                job = batch.next()
+
+            if job < 0:
+                break
+
+            if batch.failed(job):
+                raise RuntimeError(batch.error(job).decode())
+
+            yield job, segmentations[job]
+
+    finally:
+
+        # waits for running jobs to finish
+        with nogil:
+            del batch
+
+cdef __add_job(
+        BatchAgglomeration* batch,
+        affs,
+        fragments,
+        thresholds,
+        float low,
+        float high,
+        float scale,
+        arrays):
+
+    cdef np.ndarray[np.float32_t, ndim=4] float_affs
+    cdef np.ndarray[np.uint8_t, ndim=4]   quantized_affs
+    cdef np.ndarray[SegID, ndim=3]        fragments_array
+    cdef np.ndarray[SegID, ndim=4]        segmentations_array
+    cdef const SegID*                     fragments_data = NULL
+
+    seg_dtype = np.dtype('uint%d'%(8*sizeof(SegID)))
+
+    if not affs.flags['C_CONTIGUOUS']:
+        affs = np.ascontiguousarray(affs)
+    arrays.append(affs)
+
+    if fragments is not None:
+        fragments_array = np.ascontiguousarray(fragments, dtype=seg_dtype)
+        fragments_data = &fragments_array[0,0,0]
+        arrays.append(fragments_array)
+
+    thresholds = sorted(thresholds)
+    volume_shape = (affs.shape[1], affs.shape[2], affs.shape[3])
+    segmentations_array = np.zeros(
+        (len(thresholds),) + volume_shape,
+        dtype=seg_dtype)
+
+    if affs.dtype == np.uint8:
+
+        quantized_affs = affs
+        batch.addJob(
+            affs.shape[1], affs.shape[2], affs.shape[3],
+            &quantized_affs[0,0,0,0],
+            fragments_data,
+            &segmentations_array[0,0,0,0],
+            thresholds,
+            low,
+            high,
+            scale)
+
+    else:
+
+        float_affs = affs
+        batch.addJob(
+            affs.shape[1], affs.shape[2], affs.shape[3],
+            &float_affs[0,0,0,0],
+            fragments_data,
+            &segmentations_array[0,0,0,0],
+            thresholds,
+            low,
+            high)
+
+    return segmentations_array
+
+def __initialize_from_graph(u, v, affinities, contact_areas, node_sizes, scoring_expression, _ProgressReporter reporter=None):
+
+    seg_dtype = np.dtype('uint%d'%(8*sizeof(SegID)))
+
+    cdef np.ndarray[SegID, ndim=1]        u_array = np.ascontiguousarray(u, dtype=seg_dtype).ravel()
+    cdef np.ndarray[SegID, ndim=1]        v_array = np.ascontiguousarray(v, dtype=seg_dtype).ravel()
+    cdef np.ndarray[np.float32_t, ndim=1] affinities_array = np.ascontiguousarray(affinities, dtype=np.float32).ravel()
+    cdef np.ndarray[uint64_t, ndim=1]     contact_areas_array
+    cdef np.ndarray[uint64_t, ndim=1]     node_sizes_array
+    cdef const SegID*    u_data = NULL
+    cdef const SegID*    v_data = NULL
+    cdef const float*    affinities_data = NULL
+    cdef const uint64_t* contact_areas_data = NULL
+    cdef const uint64_t* node_sizes_data = NULL
+    cdef size_t          num_edges = u_array.shape[0]
+    cdef size_t          num_nodes
+    cdef string          expression = scoring_expression.encode()
+    cdef ProgressReporter* progress = __reporter_ptr(reporter)
+    cdef WaterzState     state
+
+    assert v_array.shape[0] == num_edges and affinities_array.shape[0] == num_edges, (
+        "u, v, and affinities need to have the same length")
+
+    if num_edges > 0:
+        u_data = &u_array[0]
+        v_data = &v_array[0]
+        affinities_data = &affinities_array[0]
+        num_nodes = max(u_array.max(), v_array.max()) + 1
+    else:
+        num_nodes = 1
+
+    if contact_areas is not None:
+        contact_areas_array = np.ascontiguousarray(contact_areas, dtype=np.uint64).ravel()
+        assert contact_areas_array.shape[0] == num_edges, (
+            "contact_areas needs to have the same length as u and v")
+        if num_edges > 0:
+            contact_areas_data = &contact_areas_array[0]
+
+    if node_sizes is not None:
+        node_sizes_array = np.ascontiguousarray(node_sizes, dtype=np.uint64).ravel()
+        assert node_sizes_array.shape[0] >= num_nodes, (
+            "node_sizes needs an entry for each node ID")
+        num_nodes = node_sizes_array.shape[0]
+        node_sizes_data = &node_sizes_array[0]
+
+    with nogil:
+        state = initializeFromRegionGraph(
+            num_nodes,
+            num_edges,
+            u_data,
+            v_data,
+            affinities_data,
+            contact_areas_data,
+            node_sizes_data,
+            expression,
+            progress)
+
+    return state
+
+cdef class _VectorBuffer:
+    '''Exposes the memory of a C++ vector to numpy, without copying it.'''
+
+    cdef vector[Merge]           merges
+    cdef vector[ScoredEdge]      edges
+    cdef vector[CurvePoint]      curve
+    cdef vector[DendrogramEntry] dendrogram
+    cdef char*                   data
+    cdef Py_ssize_t              shape[1]
+    cdef Py_ssize_t              strides[1]
+
+    cdef expose(self, void* data, Py_ssize_t num_bytes):
+
+        self.data = <char*>data
+        self.shape[0] = num_bytes
+        self.strides[0] = 1
+
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+
+        buffer.buf = self.data
+        buffer.format = 'B'
+        buffer.internal = NULL
+        buffer.itemsize = 1
+        buffer.len = self.shape[0]
+        buffer.ndim = 1
+        buffer.obj = self
+        buffer.readonly = 0
+        buffer.shape = self.shape
+        buffer.strides = self.strides
+        buffer.suboffsets = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
+def __merge_dtype():
+
+    seg_dtype = np.dtype('uint%d'%(8*sizeof(SegID)))
+    dtype = np.dtype([
+            ('a', seg_dtype),
+            ('b', seg_dtype),
+            ('c', seg_dtype),
+            ('score', np.float32)
+        ], align=True)
+    assert dtype.itemsize == sizeof(Merge)
+
+    return dtype
+
+def __scored_edge_dtype():
+
+    seg_dtype = np.dtype('uint%d'%(8*sizeof(SegID)))
+    dtype = np.dtype([
+            ('u', seg_dtype),
+            ('v', seg_dtype),
+            ('score', np.float32)
+        ], align=True)
+    assert dtype.itemsize == sizeof(ScoredEdge)
+
+    return dtype
+
+def __curve_point_dtype():
+
+    dtype = np.dtype([
+            ('threshold', np.float32),
+            ('rand_split', np.float64),
+            ('rand_merge', np.float64),
+            ('voi_split', np.float64),
+            ('voi_merge', np.float64)
+        ], align=True)
+    assert dtype.itemsize == sizeof(CurvePoint)
+
+    return dtype
+
+def __dendrogram_dtype():
 
-    thresholds.sort()
-    for threshold in thresholds:
+    seg_dtype = np.dtype('uint%d'%(8*sizeof(SegID)))
+    dtype = np.dtype([
+            ('child', seg_dtype),
+            ('parent', seg_dtype),
+            ('score', np.float32)
+        ], align=True)
+    assert dtype.itemsize == sizeof(DendrogramEntry)
 
-        merge_history = mergeUntil(state, threshold)
+    return dtype
 
-        result = (segmentation,)
+cdef __merge_until(
+        WaterzState& state,
+        float threshold,
+        size_t target_num_segments,
+        size_t max_segment_size,
+        ProgressReporter* progress = NULL):
 
-        if gt is not None:
+    cdef _VectorBuffer buffer = _VectorBuffer()
+    cdef vector[Merge] merges
 
-            stats = {}
-            stats['V_Rand_split'] = state.metrics.rand_split
-            stats['V_Rand_merge'] = state.metrics.rand_merge
-            stats['V_Info_split'] = state.metrics.voi_split
-            stats['V_Info_merge'] = state.metrics.voi_merge
+    with nogil:
+        merges = mergeUntil(
+            state,
+            threshold,
+            target_num_segments,
+            max_segment_size,
+            progress)
 
-            result += (stats,)
+    if merges.empty():
+        return np.zeros((0,), dtype=__merge_dtype())
 
-        if return_merge_history:
+    buffer.merges.swap(merges)
+    buffer.expose(&buffer.merges[0], buffer.merges.size()*sizeof(Merge))
+    return np.frombuffer(buffer, dtype=__merge_dtype())
 
-            result += (merge_history,)
+def __checkpoint_info(filename):
 
-        if return_region_graph:
+    cdef CheckpointInfo info = getCheckpointInfo(os.fsencode(filename))
 
-            result += (getRegionGraph(state),)
+    return (info.width, info.height, info.depth), info.hasGroundTruth
 
-        if len(result) == 1:
-            yield result[0]
-        else:
-            yield result
+def __expected_checkpoint_info(
+        affs,
+        fragments,
+        gt,
+        thresholds,
+        float aff_threshold_low,
+        float aff_threshold_high,
+        affinity_scale,
+        size_t target_num_segments,
+        size_t max_segment_size,
+        scoring_expression):
+    '''
+    The CheckpointInfo (as a dict) of a checkpoint created with the given
+    arguments.
+    '''
+
+    cdef CheckpointInfo info
+
+    affs = np.asarray(affs)
+    if affinity_scale is None:
+        affinity_scale = 1.0/255 if affs.dtype == np.uint8 else 1.0
+
+    info.width = affs.shape[1]
+    info.height = affs.shape[2]
+    info.depth = affs.shape[3]
+    info.hasGroundTruth = gt is not None
+    info.scoringExpression = scoring_expression.encode()
+    info.arguments.thresholds = sorted(thresholds)
+    info.arguments.affThresholdLow = aff_threshold_low
+    info.arguments.affThresholdHigh = aff_threshold_high
+    info.arguments.affinityScale = affinity_scale
+    info.arguments.targetNumSegments = target_num_segments
+    info.arguments.maxSegmentSize = max_segment_size
+    info.arguments.inputDigest = __input_digest(affs, fragments, gt).encode()
+
+    return info
+
+def __input_digest(*volumes):
+    '''
+    Hash the given volumes (or None), one section at a time such that
+    non-contiguous volumes are not copied as a whole.
+    '''
+
+    digest = hashlib.blake2b(digest_size=16)
+
+    for volume in volumes:
+
+        if volume is None:
+            digest.update(b'None')
+            continue
+
+        volume = np.asarray(volume)
+        digest.update(str((volume.dtype.str, volume.shape)).encode())
+        for index in np.ndindex(volume.shape[:-2]):
+            digest.update(np.ascontiguousarray(volume[index]))
+
+    return digest.hexdigest()
+
+cdef WaterzState __load_checkpoint(
+        filename,
+        np.ndarray[SegID, ndim=3] segmentation,
+        CheckpointInfo expected) except *:
+
+    cdef string      path = os.fsencode(filename)
+    cdef SegID*      segmentation_data = &segmentation[0,0,0]
+    cdef WaterzState state
+
+    with nogil:
+        state = loadCheckpoint(path, segmentation_data, &expected)
+
+    return state
+
+cdef __save_checkpoint(WaterzState& state, filename, CheckpointArguments arguments):
+
+    cdef string path = os.fsencode(filename)
+
+    with nogil:
+        saveCheckpoint(state, path, arguments)
+
+cdef __get_merge_statistics(WaterzState& state):
+
+    cdef MergeStatistics statistics = getMergeStatistics(state)
+
+    return {
+        'pops': statistics.pops,
+        'deleted_pops': statistics.deletedPops,
+        'stale_pops': statistics.stalePops,
+        'merges': statistics.merges,
+        'mean_score_delta': statistics.meanScoreDelta,
+        'max_score_delta': statistics.maxScoreDelta,
+        'max_degree': statistics.maxDegree,
+        'scoring_seconds': statistics.scoringSeconds,
+        'merging_seconds': statistics.mergingSeconds,
+        'extraction_seconds': statistics.extractionSeconds,
+        'evaluation_seconds': statistics.evaluationSeconds,
+        'stages': __get_stage_timings(state),
+        'memory': __get_memory_usage(state),
+    }
+
+cdef __get_stage_timings(WaterzState& state):
+
+    cdef vector[StageTiming] stage_timings = getStageTimings(state)
+
+    stages = []
+    for i in range(stage_timings.size()):
+        stages.append({
+            'stage': stage_timings[i].stage.decode(),
+            'seconds': stage_timings[i].seconds,
+            'resident_mb': stage_timings[i].residentMb,
+        })
+
+    return stages
+
+cdef __get_memory_usage(WaterzState& state):
+
+    return __component_memory_dict(getMemoryUsage(state))
+
+def estimate_memory(
+        width,
+        height,
+        depth,
+        num_fragments,
+        quantized_affinities,
+        find_fragments,
+        scoring_expression=''):
+
+    return __component_memory_dict(
+        estimateMemoryUsage(
+            width, height, depth,
+            num_fragments,
+            quantized_affinities,
+            find_fragments,
+            scoring_expression.encode()))
+
+cdef __component_memory_dict(vector[ComponentMemory] components):
+
+    memory = {}
+    for i in range(components.size()):
+        memory[components[i].component.decode()] = {
+            'bytes': components[i].bytes,
+            'peak_bytes': components[i].peakBytes,
+        }
+
+    return memory
+
+# the Python callable log messages are passed to, see set_log_level()
+_log_callback = None
+
+cdef void __log_to_callback(int level, const char* message) noexcept with gil:
+
+    try:
+        _log_callback(level, message.decode('utf-8', 'replace'))
+    except Exception:
+        # do not propagate into the C++ code that logged
+        pass
+
+def set_log_level(level, callback=None):
+    '''
+    Set the log level (see LogLevel in backend/Telemetry.hpp) of this module,
+    and the callable(level, message) to pass messages to. Without callback,
+    messages are written to stderr.
+    '''
+
+    global _log_callback
+
+    _log_callback = callback
+    setLogLevel(level)
+    if callback is None:
+        setLogSink(NULL)
+    else:
+        setLogSink(__log_to_callback)
+
+def __log(level, message):
+
+    logMessage(level, message.encode())
+
+cdef class _ProgressReporter:
+    '''
+    Owns a ProgressReporter that passes the progress of the C++ code to a
+    Python callable, see __report_progress().
+    '''
+
+    cdef ProgressReporter* reporter
+    cdef object            callback
+    cdef object            error
+
+    def __dealloc__(self):
+        del self.reporter
+
+cdef bool __report_progress(const Progress& progress, void* data) noexcept with gil:
+
+    cdef _ProgressReporter reporter = <_ProgressReporter>data
+
+    try:
+        return reporter.callback({
+            'stage': progress.stage.decode(),
+            'done': progress.done,
+            'total': progress.total,
+            'min_score': progress.minScore,
+            'queue_size': progress.queueSize,
+            'seconds': progress.seconds,
+        }) is not False
+    except BaseException as e:
+        # cancel, and raise once back in Python (see __raise_if_cancelled())
+        reporter.error = e
+        return False
+
+cdef _ProgressReporter __progress_reporter(callback, double interval):
+
+    cdef _ProgressReporter reporter
+
+    if callback is None:
+        return None
+
+    reporter = _ProgressReporter()
+    reporter.callback = callback
+    reporter.reporter = new ProgressReporter(__report_progress, <void*>reporter, interval)
+
+    return reporter
+
+cdef ProgressReporter* __reporter_ptr(_ProgressReporter reporter):
+
+    if reporter is None:
+        return NULL
+    return reporter.reporter
+
+cdef __raise_if_cancelled(_ProgressReporter reporter):
+
+    if reporter is None or not reporter.reporter.cancelled():
+        return
+
+    if reporter.error is not None:
+        raise reporter.error
+
+    from waterz import Cancelled
+    raise Cancelled()
+
+cdef __get_region_graph(WaterzState& state):
+
+    cdef _VectorBuffer buffer = _VectorBuffer()
+    cdef vector[ScoredEdge] edges
+
+    with nogil:
+        edges = getRegionGraph(state)
 
-    free(state)
+    if edges.empty():
+        return np.zeros((0,), dtype=__scored_edge_dtype())
+
+    buffer.edges.swap(edges)
+    buffer.expose(&buffer.edges[0], buffer.edges.size()*sizeof(ScoredEdge))
+    return np.frombuffer(buffer, dtype=__scored_edge_dtype())
 
 def __initialize(
-        np.ndarray[np.float32_t, ndim=4] affs,
-        np.ndarray[uint64_t, ndim=3]     segmentation,
+        affs,
+        np.ndarray[SegID, ndim=3]        segmentation,
         np.ndarray[uint32_t, ndim=3]     gt = None,
         aff_threshold_low  = 0.0001,
         aff_threshold_high = 0.9999,
-        find_fragments = True):
+        affinity_scale = None,
+        find_fragments = True,
+        scoring_expression = '',
+        _ProgressReporter reporter = None):
 
-    cdef float*    aff_data
-    cdef uint64_t* segmentation_data
-    cdef uint32_t* gt_data = NULL
+    cdef np.ndarray[np.float32_t, ndim=4] float_affs
+    cdef np.ndarray[np.uint8_t, ndim=4]   quantized_affs
+    cdef const float*   float_data
+    cdef const uint8_t* quantized_data
+    cdef SegID*         segmentation_data
+    cdef uint32_t*      gt_data = NULL
+    cdef size_t         width = affs.shape[1]
+    cdef size_t         height = affs.shape[2]
+    cdef size_t         depth = affs.shape[3]
+    cdef float          low = aff_threshold_low
+    cdef float          high = aff_threshold_high
+    cdef float          scale
+    cdef bool           find = find_fragments
+    cdef string         expression = scoring_expression.encode()
+    cdef ProgressReporter* progress = __reporter_ptr(reporter)
+    cdef WaterzState    state
 
-    aff_data = &affs[0,0,0,0]
     segmentation_data = &segmentation[0,0,0]
     if gt is not None:
         gt_data = &gt[0,0,0]
 
-    return initialize(
-        affs.shape[1], affs.shape[2], affs.shape[3],
-        aff_data,
-        segmentation_data,
-        gt_data,
-        aff_threshold_low,
-        aff_threshold_high,
-        find_fragments)
+    if affs.dtype == np.uint8:
+
+        if affinity_scale is None:
+            affinity_scale = 1.0/255
+
+        quantized_affs = affs
+        quantized_data = &quantized_affs[0,0,0,0]
+        scale = affinity_scale
+
+        with nogil:
+            state = initialize(
+                width, height, depth,
+                quantized_data,
+                segmentation_data,
+                gt_data,
+                low,
+                high,
+                scale,
+                find,
+                expression,
+                progress)
+
+        return state
+
+    assert affinity_scale is None, (
+        "affinity_scale is only supported for uint8 affinities")
+
+    float_affs = affs
+    float_data = &float_affs[0,0,0,0]
+
+    with nogil:
+        state = initialize(
+            width, height, depth,
+            float_data,
+            segmentation_data,
+            gt_data,
+            low,
+            high,
+            find,
+            expression,
+            progress)
+
+    return state
+
+cdef extern from "backend/Telemetry.hpp" nogil:
+
+    cdef enum LogLevel:
+        LOG_LEVEL_SILENT
+        LOG_LEVEL_ERROR
+        LOG_LEVEL_WARNING
+        LOG_LEVEL_INFO
+        LOG_LEVEL_DEBUG
+
+    ctypedef void (*LogSink)(int level, const char* message) noexcept
+
+    struct StageTiming:
+        string stage
+        double seconds
+        double residentMb
+
+    void setLogLevel(int level)
+
+    void setLogSink(LogSink sink)
 
-cdef extern from "frontend_agglomerate.h":
+    void logMessage(int level, const string& message)
+
+cdef extern from "backend/Progress.hpp" nogil:
+
+    struct Progress:
+        const char* stage
+        size_t      done
+        size_t      total
+        double      minScore
+        size_t      queueSize
+        double      seconds
+
+    ctypedef bool (*ProgressCallback)(const Progress& progress, void* data) noexcept
+
+    cdef cppclass ProgressReporter:
+
+        ProgressReporter(
+                ProgressCallback callback,
+                void*            data,
+                double           intervalSeconds)
+
+        void cancel()
+
+        bool cancelled()
+
+cdef extern from "backend/MemoryUsage.hpp" nogil:
+
+    struct ComponentMemory:
+        string component
+        size_t bytes
+        size_t peakBytes
+
+cdef extern from "frontend_agglomerate.h" nogil:
+
+    # the actual width is set by the generated SegID.h
+    ctypedef uint64_t SegID
 
     struct Metrics:
         double voi_split
@@ -105,35 +963,176 @@ cdef extern from "frontend_agglomerate.h":
         double rand_merge
 
     struct Merge:
-        uint64_t a
-        uint64_t b
-        uint64_t c
-        double score
+        SegID a
+        SegID b
+        SegID c
+        float score
 
     struct ScoredEdge:
-        uint64_t u
-        uint64_t v
-        double score
+        SegID u
+        SegID v
+        float score
+
+    struct CurvePoint:
+        float  threshold
+        double rand_split
+        double rand_merge
+        double voi_split
+        double voi_merge
+
+    ctypedef struct DendrogramEntry:
+        SegID child
+        SegID parent
+        float score
 
     struct WaterzState:
         int     context
         Metrics metrics
 
+    struct MergeStatistics:
+        size_t pops
+        size_t deletedPops
+        size_t stalePops
+        size_t merges
+        double meanScoreDelta
+        double maxScoreDelta
+        size_t maxDegree
+        double scoringSeconds
+        double mergingSeconds
+        double extractionSeconds
+        double evaluationSeconds
+
+    struct CheckpointArguments:
+        vector[float] thresholds
+        float         affThresholdLow
+        float         affThresholdHigh
+        float         affinityScale
+        size_t        targetNumSegments
+        size_t        maxSegmentSize
+        string        inputDigest
+
+    struct CheckpointInfo:
+        size_t              width
+        size_t              height
+        size_t              depth
+        bool                hasGroundTruth
+        string              scoringExpression
+        CheckpointArguments arguments
+
     WaterzState initialize(
             size_t          width,
             size_t          height,
             size_t          depth,
             const float*    affinity_data,
-            uint64_t*       segmentation_data,
+            SegID*          segmentation_data,
+            const uint32_t* groundtruth_data,
+            float           affThresholdLow,
+            float           affThresholdHigh,
+            bool            findFragments,
+            const string&   scoringExpression,
+            ProgressReporter* progress) except +
+
+    WaterzState initialize(
+            size_t          width,
+            size_t          height,
+            size_t          depth,
+            const uint8_t*  affinity_data,
+            SegID*          segmentation_data,
             const uint32_t* groundtruth_data,
             float           affThresholdLow,
             float           affThresholdHigh,
-            bool            findFragments);
+            float           affinityScale,
+            bool            findFragments,
+            const string&   scoringExpression,
+            ProgressReporter* progress) except +
+
+    WaterzState initializeFromRegionGraph(
+            size_t          numNodes,
+            size_t          numEdges,
+            const SegID*    u,
+            const SegID*    v,
+            const float*    affinities,
+            const uint64_t* contactAreas,
+            const uint64_t* nodeSizes,
+            const string&   scoringExpression,
+            ProgressReporter* progress) except +
 
     vector[Merge] mergeUntil(
-            WaterzState& state,
-            float        threshold)
+            WaterzState&      state,
+            float             threshold,
+            size_t            targetNumSegments,
+            size_t            maxSegmentSize,
+            ProgressReporter* progress) except +
+
+    MergeStatistics getMergeStatistics(WaterzState& state)
+
+    vector[StageTiming] getStageTimings(WaterzState& state)
 
-    vector[ScoredEdge] getRegionGraph(WaterzState& state)
+    vector[ComponentMemory] getMemoryUsage(WaterzState& state)
+
+    vector[ComponentMemory] estimateMemoryUsage(
+            size_t        width,
+            size_t        height,
+            size_t        depth,
+            size_t        numFragments,
+            bool          quantizedAffinities,
+            bool          findFragments,
+            const string& scoringExpression) except +
+
+    vector[CurvePoint] getMetricsCurve(
+            WaterzState&  state,
+            vector[float] thresholds,
+            bool          everyMerge) except +
+
+    vector[DendrogramEntry] getDendrogram(WaterzState& state) except +
+
+    vector[ScoredEdge] getRegionGraph(WaterzState& state) except +
+
+    void saveCheckpoint(
+            WaterzState&               state,
+            const string&              filename,
+            const CheckpointArguments& arguments) except +
+
+    CheckpointInfo getCheckpointInfo(const string& filename) except +
+
+    WaterzState loadCheckpoint(
+            const string&         filename,
+            SegID*                segmentation_data,
+            const CheckpointInfo* expected) except +
 
     void free(WaterzState& state)
+
+    cdef cppclass BatchAgglomeration:
+
+        BatchAgglomeration(const string& scoringExpression)
+
+        void addJob(
+                size_t           width,
+                size_t           height,
+                size_t           depth,
+                const float*     affinity_data,
+                const SegID*     fragments_data,
+                SegID*           segmentations_data,
+                vector[float]    thresholds,
+                float            affThresholdLow,
+                float            affThresholdHigh) except +
+
+        void addJob(
+                size_t           width,
+                size_t           height,
+                size_t           depth,
+                const uint8_t*   affinity_data,
+                const SegID*     fragments_data,
+                SegID*           segmentations_data,
+                vector[float]    thresholds,
+                float            affThresholdLow,
+                float            affThresholdHigh,
+                float            affinityScale) except +
+
+        void start(int numThreads) except +
+
+        int next()
+
+        bool failed(int job)
+
+        string error(int job)
@@ -1,8 +1,10 @@
 #ifndef WATERZ_BIN_QUEUE_H__
 #define WATERZ_BIN_QUEUE_H__
 
-#include <queue>
+#include <deque>
 #include "discretize.hpp"
+#include "Serialization.hpp"
+#include "MemoryUsage.hpp"
 
 /**
  * A priority queue sorting elements from smallest to largest.
@@ -22,7 +24,7 @@ public:
 
 		int i = discretize<int>(score, N);
 
-		_bins[i].push(element);
+		_bins[i].push_back(element);
 		if (_minBin == -1)
 			_minBin = i;
 		else
@@ -36,7 +38,7 @@ public:
 
 	void pop() {
 
-		_bins[_minBin].pop();
+		_bins[_minBin].pop_front();
 
 		if (_bins[_minBin].empty()) {
 
@@ -67,9 +69,49 @@ public:
 		return sum;
 	}
 
+	/**
+	 * Bytes allocated for the bins.
+	 */
+	std::size_t memoryUsage() const {
+
+		std::size_t bytes = 0;
+		for (int i = 0; i < N; i++)
+			bytes += allocatedBytes(_bins[i]);
+
+		return bytes;
+	}
+
+	/**
+	 * Estimate memoryUsage() for a queue of numElements elements.
+	 */
+	static std::size_t estimateMemoryUsage(std::size_t numElements) {
+
+		// every bin allocates a block, even if empty
+		return N*allocatedBytes(std::deque<T>()) + numElements*sizeof(T);
+	}
+
+	void save(BinaryWriter& out) const {
+
+		out.write(_minBin);
+		for (int i = 0; i < N; i++)
+			out.write(std::vector<T>(_bins[i].begin(), _bins[i].end()));
+	}
+
+	void load(BinaryReader& in) {
+
+		in.read(_minBin);
+		for (int i = 0; i < N; i++) {
+
+			std::vector<T> bin;
+			in.read(bin);
+			_bins[i].assign(bin.begin(), bin.end());
+		}
+	}
+
 private:
 
-	std::queue<T> _bins[N];
+	// FIFO queues, as std::deque to be able to save them
+	std::deque<T> _bins[N];
 
 	// smallest non-empty bin
 	int _minBin;
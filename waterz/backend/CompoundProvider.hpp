@@ -34,6 +34,13 @@ public:
 		Parent::addAffinity(e, affinity);
 	}
 
+	template <typename EdgeIdType, typename ScoreType>
+	inline void addAffinities(EdgeIdType e, ScoreType affinity, std::size_t count) {
+
+		Head::addAffinities(e, affinity, count);
+		Parent::addAffinities(e, affinity, count);
+	}
+
 	template <typename NodeIdType>
 	inline void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) {
 
@@ -41,6 +48,13 @@ public:
 		Parent::addVoxel(n, x, y, z);
 	}
 
+	template <typename NodeIdType>
+	inline void addVoxels(NodeIdType n, std::size_t count) {
+
+		Head::addVoxels(n, count);
+		Parent::addVoxels(n, count);
+	}
+
 	template<typename NodeIdType>
 	inline bool notifyNodeMerge(NodeIdType from, NodeIdType to) {
 
@@ -56,6 +70,23 @@ public:
 				Head::notifyEdgeMerge(from, to) ||
 				Parent::notifyEdgeMerge(from, to));
 	}
+
+	inline std::size_t memoryUsage() const {
+
+		return Head::memoryUsage() + Parent::memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		Head::save(out);
+		Parent::save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		Head::load(in);
+		Parent::load(in);
+	}
 };
 
 
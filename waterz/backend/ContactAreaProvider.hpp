@@ -22,6 +22,12 @@ public:
 		_contactArea[e]++;
 	}
 
+	template<typename ScoreType>
+	inline void addAffinities(EdgeIdType e, ScoreType affinity, std::size_t count) {
+
+		_contactArea[e] += count;
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		_contactArea[to] += _contactArea[from];
@@ -35,6 +41,21 @@ public:
 		return _contactArea[e];
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _contactArea.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_contactArea.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_contactArea.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<ValueType> _contactArea;
@@ -0,0 +1,177 @@
+#ifndef WATERZ_CONTINGENCY_TABLE_H__
+#define WATERZ_CONTINGENCY_TABLE_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Counts co-occurrences of label pairs (i, j) in an open-addressing hash table 
+ * with linear probing.
+ */
+class ContingencyTable {
+
+public:
+
+	typedef uint64_t LabelType;
+	typedef uint64_t CountType;
+
+	struct Entry {
+
+		LabelType i;
+		LabelType j;
+
+		// 0 marks an empty slot
+		CountType count;
+	};
+
+	ContingencyTable(std::size_t capacity = 1024) :
+		_size(0) {
+
+		std::size_t c = 16;
+		while (c < 2*capacity)
+			c *= 2;
+
+		_entries.resize(c, Entry{0, 0, 0});
+	}
+
+	/**
+	 * Add n co-occurrences of (i, j).
+	 */
+	inline void add(LabelType i, LabelType j, CountType n = 1) {
+
+		std::size_t mask = _entries.size() - 1;
+		std::size_t slot = hash(i, j) & mask;
+
+		while (true) {
+
+			Entry& entry = _entries[slot];
+
+			if (entry.count == 0) {
+
+				entry.i = i;
+				entry.j = j;
+				entry.count = n;
+
+				// keep the load factor below 0.5
+				if (++_size*2 > _entries.size())
+					grow();
+
+				return;
+			}
+
+			if (entry.i == i && entry.j == j) {
+
+				entry.count += n;
+				return;
+			}
+
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	/**
+	 * Add all counts of another table to this one.
+	 */
+	void add(const ContingencyTable& other) {
+
+		for (const Entry& entry : other._entries)
+			if (entry.count)
+				add(entry.i, entry.j, entry.count);
+	}
+
+	/**
+	 * Add the pairs of two label arrays, skipping all pairs where the first 
+	 * label is 0. Consecutive runs of equal pairs are counted before they are 
+	 * added to the table, which avoids most hash lookups for the typical 
+	 * contiguous label volumes. The strides are given in elements and allow 
+	 * to read from views into larger arrays.
+	 */
+	template <typename I, typename J>
+	void addArrays(
+			const I* is,
+			const J* js,
+			std::size_t n,
+			std::ptrdiff_t isStride = 1,
+			std::ptrdiff_t jsStride = 1) {
+
+		std::size_t k = 0;
+		while (k < n) {
+
+			LabelType i = *is;
+			LabelType j = *js;
+
+			std::size_t run = 1;
+			k++;
+			is += isStride;
+			js += jsStride;
+			while (k < n && *is == i && *js == j) {
+
+				run++;
+				k++;
+				is += isStride;
+				js += jsStride;
+			}
+
+			if (i)
+				add(i, j, run);
+		}
+	}
+
+	/**
+	 * Get all non-empty entries.
+	 */
+	std::vector<Entry> entries() const {
+
+		std::vector<Entry> result;
+		result.reserve(_size);
+		for (const Entry& entry : _entries)
+			if (entry.count)
+				result.push_back(entry);
+
+		return result;
+	}
+
+	/**
+	 * The number of distinct pairs.
+	 */
+	std::size_t size() const { return _size; }
+
+	void clear() {
+
+		std::fill(_entries.begin(), _entries.end(), Entry{0, 0, 0});
+		_size = 0;
+	}
+
+private:
+
+	static inline std::size_t hash(LabelType i, LabelType j) {
+
+		// combine and finalize as in MurmurHash3
+		uint64_t h = i*0x9E3779B97F4A7C15ULL ^ (j + 0x632BE59BD9B4E019ULL + (i << 6) + (i >> 2));
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+
+		return h;
+	}
+
+	void grow() {
+
+		std::vector<Entry> old(_entries.size()*2, Entry{0, 0, 0});
+		old.swap(_entries);
+		_size = 0;
+
+		for (const Entry& entry : old)
+			if (entry.count)
+				add(entry.i, entry.j, entry.count);
+	}
+
+	std::vector<Entry> _entries;
+	std::size_t _size;
+};
+
+#endif // WATERZ_CONTINGENCY_TABLE_H__
@@ -0,0 +1,55 @@
+#ifndef WATERZ_DENDROGRAM_H__
+#define WATERZ_DENDROGRAM_H__
+
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * One merge of a dendrogram: child got merged into parent with the given score. 
+ * A dendrogram is a sequence of those in merge order, with scores made 
+ * non-decreasing (each score is the maximum of all scores up to this merge).
+ */
+template <typename NodeIdType, typename ScoreType>
+struct DendrogramMerge {
+
+	NodeIdType child;
+	NodeIdType parent;
+	ScoreType  score;
+};
+
+/**
+ * Cut a dendrogram at the given threshold, i.e., apply all merges with a score 
+ * lower than the threshold. The result is a map from each of the numLabels 
+ * node IDs to the ID of its region, which is the same as the segmentation 
+ * obtained with mergeUntil(threshold) would contain.
+ *
+ * Runs in O(numLabels + log(numMerges) + number of applied merges).
+ */
+template <typename NodeIdType, typename ScoreType>
+void
+cutDendrogram(
+		const DendrogramMerge<NodeIdType, ScoreType>* merges,
+		std::size_t numMerges,
+		ScoreType threshold,
+		NodeIdType* labels,
+		std::size_t numLabels) {
+
+	typedef DendrogramMerge<NodeIdType, ScoreType> MergeType;
+
+	// the number of merges below the threshold
+	std::size_t k = std::lower_bound(
+			merges,
+			merges + numMerges,
+			threshold,
+			[](const MergeType& merge, ScoreType t) { return merge.score < t; }) - merges;
+
+	for (std::size_t i = 0; i < numLabels; i++)
+		labels[i] = i;
+
+	// A parent can only become a child in a later merge, so walking the merges 
+	// backwards resolves each parent to its final region before it is used.
+	for (std::size_t i = k; i-- > 0;)
+		labels[merges[i].child] = labels[merges[i].parent];
+}
+
+#endif // WATERZ_DENDROGRAM_H__
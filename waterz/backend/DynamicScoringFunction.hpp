@@ -0,0 +1,617 @@
+#ifndef WATERZ_DYNAMIC_SCORING_FUNCTION_H__
+#define WATERZ_DYNAMIC_SCORING_FUNCTION_H__
+
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MergeFunctions.hpp"
+#include "Operators.hpp"
+
+/**
+ * Type-erased interface to the statistics providers used by a
+ * DynamicStatisticsProvider.
+ */
+template <typename RegionGraphType, typename Precision>
+class DynamicProviderBase {
+
+public:
+
+	typedef typename RegionGraphType::NodeIdType NodeIdType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+
+	virtual ~DynamicProviderBase() {}
+
+	virtual void notifyNewEdge(EdgeIdType e) = 0;
+	virtual void addAffinity(EdgeIdType e, Precision affinity) = 0;
+	virtual void addAffinities(EdgeIdType e, Precision affinity, std::size_t count) = 0;
+	virtual void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) = 0;
+	virtual void addVoxels(NodeIdType n, std::size_t count) = 0;
+	virtual bool notifyNodeMerge(NodeIdType from, NodeIdType to) = 0;
+	virtual bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) = 0;
+	virtual void save(BinaryWriter& out) const = 0;
+	virtual void load(BinaryReader& in) = 0;
+	virtual std::size_t memoryUsage() const = 0;
+};
+
+template <typename RegionGraphType, typename Precision, typename ProviderType>
+class DynamicProvider : public DynamicProviderBase<RegionGraphType, Precision> {
+
+public:
+
+	typedef typename RegionGraphType::NodeIdType NodeIdType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+
+	template <typename ... Args>
+	DynamicProvider(RegionGraphType& regionGraph, Args ... args) :
+		_provider(regionGraph, args...) {}
+
+	void notifyNewEdge(EdgeIdType e) override { _provider.notifyNewEdge(e); }
+	void addAffinity(EdgeIdType e, Precision affinity) override { _provider.addAffinity(e, affinity); }
+	void addAffinities(EdgeIdType e, Precision affinity, std::size_t count) override { _provider.addAffinities(e, affinity, count); }
+	void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) override { _provider.addVoxel(n, x, y, z); }
+	void addVoxels(NodeIdType n, std::size_t count) override { _provider.addVoxels(n, count); }
+	bool notifyNodeMerge(NodeIdType from, NodeIdType to) override { return _provider.notifyNodeMerge(from, to); }
+	bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) override { return _provider.notifyEdgeMerge(from, to); }
+	void save(BinaryWriter& out) const override { _provider.save(out); }
+	void load(BinaryReader& in) override { _provider.load(in); }
+	std::size_t memoryUsage() const override { return _provider.memoryUsage(); }
+
+	const ProviderType& get() const { return _provider; }
+
+private:
+
+	ProviderType _provider;
+};
+
+/**
+ * A statistics provider for scoring functions given at runtime. The scoring
+ * function is parsed from the same expressions used for compiled scoring
+ * functions, e.g., "OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>". Only
+ * the providers needed by the expression are created, each once, even if used
+ * several times.
+ *
+ * The expression is compiled into a flat program in postfix order, which is
+ * evaluated for each edge on a small stack without virtual calls. All
+ * arithmetic is done in Precision (the compiled scoring functions use the
+ * value type of the first operand instead).
+ *
+ * Limitations: HistogramQuantileAffinity supports only HistogramBins bins, and
+ * MeanMaxKAffinity only K <= MaxK.
+ */
+template <typename RegionGraphType, typename Precision>
+class DynamicStatisticsProvider : public StatisticsProvider {
+
+public:
+
+	typedef typename RegionGraphType::NodeIdType NodeIdType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+
+	static const int HistogramBins = 256;
+	static const int MaxK = 8;
+
+	DynamicStatisticsProvider(RegionGraphType& regionGraph) :
+		_regionGraph(regionGraph) {}
+
+	/**
+	 * Set the scoring function. Has to be called once, before any edges are
+	 * added to the region graph. Throws std::invalid_argument if the expression
+	 * can not be parsed.
+	 */
+	void setExpression(const std::string& expression) {
+
+		if (!_expression.empty())
+			throw std::logic_error("scoring function was already set");
+
+		if (expression.empty())
+			throw std::invalid_argument("no scoring function given");
+
+		_expression = expression;
+		_pos = 0;
+
+		int depth = 0;
+		int maxDepth = 0;
+		parseTerm(depth, maxDepth, true);
+		skipSpace();
+
+		if (_pos != _expression.size())
+			parseError("unexpected characters after scoring function");
+
+		if (maxDepth > MaxStackSize)
+			throw std::invalid_argument("scoring function is nested too deeply");
+	}
+
+	const std::string& getExpression() const { return _expression; }
+
+	/**
+	 * Evaluate the scoring function for edge e.
+	 */
+	inline Precision evaluate(EdgeIdType e) const {
+
+		Precision stack[MaxStackSize];
+		int top = -1;
+
+		for (const Instruction& instruction : _program) {
+
+			switch (instruction.op) {
+
+			case MinSizeOp: {
+				const RegionSizeType& sizes = get<RegionSizeType>(instruction);
+				stack[++top] = std::min(sizes[_regionGraph.edge(e).u], sizes[_regionGraph.edge(e).v]);
+				break;
+			}
+			case MaxSizeOp: {
+				const RegionSizeType& sizes = get<RegionSizeType>(instruction);
+				stack[++top] = std::max(sizes[_regionGraph.edge(e).u], sizes[_regionGraph.edge(e).v]);
+				break;
+			}
+			case MinAffinityOp:
+				stack[++top] = get<MinAffinityType>(instruction)[e];
+				break;
+			case MaxAffinityOp:
+				stack[++top] = get<MaxAffinityType>(instruction)[e];
+				break;
+			case MeanAffinityOp:
+				stack[++top] = get<MeanAffinityType>(instruction)[e];
+				break;
+			case HistogramQuantileOp:
+				stack[++top] = get<HistogramQuantileType<true>>(instruction).quantile(e, instruction.param);
+				break;
+			case HistogramQuantileAllOp:
+				stack[++top] = get<HistogramQuantileType<false>>(instruction).quantile(e, instruction.param);
+				break;
+			case VectorQuantileOp:
+				stack[++top] = get<VectorQuantileType<true>>(instruction)[e];
+				break;
+			case VectorQuantileAllOp:
+				stack[++top] = get<VectorQuantileType<false>>(instruction)[e];
+				break;
+			case MeanMaxKAffinityOp:
+				stack[++top] = get<MaxKAffinityType>(instruction)[e].average(instruction.param);
+				break;
+			case ContactAreaOp:
+				stack[++top] = get<ContactAreaType>(instruction)[e];
+				break;
+			case RandomOp:
+				stack[++top] = Precision(rand())/RAND_MAX;
+				break;
+			case ConstantOp:
+				stack[++top] = instruction.param;
+				break;
+			case OneMinusOp:
+				stack[top] = one_minus<Precision>()(stack[top]);
+				break;
+			case InvertOp:
+				stack[top] = invert<Precision>()(stack[top]);
+				break;
+			case SquareOp:
+				stack[top] = square<Precision>()(stack[top]);
+				break;
+			case AddOp:
+				top--;
+				stack[top] = std::plus<Precision>()(stack[top], stack[top + 1]);
+				break;
+			case SubtractOp:
+				top--;
+				stack[top] = std::minus<Precision>()(stack[top], stack[top + 1]);
+				break;
+			case MultiplyOp:
+				top--;
+				stack[top] = std::multiplies<Precision>()(stack[top], stack[top + 1]);
+				break;
+			case DivideOp:
+				top--;
+				stack[top] = save_divide<Precision>()(stack[top], stack[top + 1]);
+				break;
+			case StepOp:
+				top--;
+				stack[top] = step<Precision>()(stack[top], stack[top + 1]);
+				break;
+			}
+		}
+
+		return stack[0];
+	}
+
+	inline void notifyNewEdge(EdgeIdType e) {
+
+		for (auto& provider : _providers)
+			provider->notifyNewEdge(e);
+	}
+
+	template <typename ScoreType>
+	inline void addAffinity(EdgeIdType e, ScoreType affinity) {
+
+		for (auto& provider : _providers)
+			provider->addAffinity(e, affinity);
+	}
+
+	template <typename ScoreType>
+	inline void addAffinities(EdgeIdType e, ScoreType affinity, std::size_t count) {
+
+		for (auto& provider : _providers)
+			provider->addAffinities(e, affinity, count);
+	}
+
+	inline void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) {
+
+		for (auto& provider : _providers)
+			provider->addVoxel(n, x, y, z);
+	}
+
+	inline void addVoxels(NodeIdType n, std::size_t count) {
+
+		for (auto& provider : _providers)
+			provider->addVoxels(n, count);
+	}
+
+	inline bool notifyNodeMerge(NodeIdType from, NodeIdType to) {
+
+		// all providers have to see the merge
+		bool changed = false;
+		for (auto& provider : _providers)
+			changed |= provider->notifyNodeMerge(from, to);
+
+		return changed;
+	}
+
+	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
+
+		bool changed = false;
+		for (auto& provider : _providers)
+			changed |= provider->notifyEdgeMerge(from, to);
+
+		return changed;
+	}
+
+	inline std::size_t memoryUsage() const {
+
+		std::size_t bytes = 0;
+		for (const auto& provider : _providers)
+			bytes += provider->memoryUsage();
+
+		return bytes;
+	}
+
+	/**
+	 * Write the expression and the statistics of all providers.
+	 */
+	inline void save(BinaryWriter& out) const {
+
+		out.write(_expression);
+		for (const auto& provider : _providers)
+			provider->save(out);
+	}
+
+	/**
+	 * Restore the expression and the statistics of all providers, after the
+	 * region graph has been restored.
+	 */
+	inline void load(BinaryReader& in) {
+
+		std::string expression;
+		in.read(expression);
+		setExpression(expression);
+
+		for (auto& provider : _providers)
+			provider->load(in);
+	}
+
+private:
+
+	typedef DynamicProviderBase<RegionGraphType, Precision> ProviderBase;
+
+	typedef RegionSizeProvider<RegionGraphType>               RegionSizeType;
+	typedef ContactAreaProvider<RegionGraphType>              ContactAreaType;
+	typedef MinAffinityProvider<RegionGraphType, Precision>   MinAffinityType;
+	typedef MaxAffinityProvider<RegionGraphType, Precision>   MaxAffinityType;
+	typedef MeanAffinityProvider<RegionGraphType, Precision>  MeanAffinityType;
+	typedef MaxKAffinityProvider<RegionGraphType, MaxK, Precision> MaxKAffinityType;
+	// the quantile is set at runtime, the template argument is not used
+	template <bool InitWithMax>
+	using HistogramQuantileType = HistogramQuantileProvider<RegionGraphType, 50, Precision, HistogramBins, InitWithMax>;
+	template <bool InitWithMax>
+	using VectorQuantileType = VectorQuantileProvider<RegionGraphType, 50, Precision, InitWithMax>;
+
+	static const int MaxStackSize = 32;
+
+	enum Op {
+
+		MinSizeOp,
+		MaxSizeOp,
+		MinAffinityOp,
+		MaxAffinityOp,
+		MeanAffinityOp,
+		HistogramQuantileOp,
+		HistogramQuantileAllOp,
+		VectorQuantileOp,
+		VectorQuantileAllOp,
+		MeanMaxKAffinityOp,
+		ContactAreaOp,
+		RandomOp,
+		ConstantOp,
+		OneMinusOp,
+		InvertOp,
+		SquareOp,
+		AddOp,
+		SubtractOp,
+		MultiplyOp,
+		DivideOp,
+		StepOp
+	};
+
+	struct Instruction {
+
+		Op                  op;
+		int                 param;
+		const ProviderBase* provider;
+	};
+
+	template <typename ProviderType>
+	inline const ProviderType& get(const Instruction& instruction) const {
+
+		return static_cast<const DynamicProvider<RegionGraphType, Precision, ProviderType>*>(instruction.provider)->get();
+	}
+
+	/**
+	 * Get the provider with the given key, create it with the given arguments
+	 * if it does not exist yet.
+	 */
+	template <typename ProviderType, typename ... Args>
+	const ProviderBase* provider(const std::string& key, Args ... args) {
+
+		auto it = _providersByKey.find(key);
+		if (it != _providersByKey.end())
+			return it->second;
+
+		_providers.emplace_back(new DynamicProvider<RegionGraphType, Precision, ProviderType>(_regionGraph, args...));
+		_providersByKey[key] = _providers.back().get();
+
+		return _providers.back().get();
+	}
+
+	void emit(Op op, int param = 0, const ProviderBase* provider = NULL) {
+
+		_program.push_back({op, param, provider});
+	}
+
+	void skipSpace() {
+
+		while (_pos < _expression.size() && std::isspace(_expression[_pos]))
+			_pos++;
+	}
+
+	bool accept(char c) {
+
+		skipSpace();
+		if (_pos < _expression.size() && _expression[_pos] == c) {
+
+			_pos++;
+			return true;
+		}
+
+		return false;
+	}
+
+	void expect(char c) {
+
+		if (!accept(c))
+			parseError(std::string("expected '") + c + "'");
+	}
+
+	void parseError(const std::string& message) const {
+
+		std::stringstream ss;
+		ss << message << " at position " << _pos << " of scoring function '" << _expression << "'";
+		throw std::invalid_argument(ss.str());
+	}
+
+	bool isScoringFunction(const std::string& name) const {
+
+		static const char* names[] = {
+			"OneMinus", "Invert", "Square",
+			"Add", "Subtract", "Multiply", "Divide", "Step",
+			"MinSize", "MaxSize",
+			"MinAffinity", "MaxAffinity", "MeanAffinity",
+			"HistogramQuantileAffinity", "QuantileAffinity", "MeanMaxKAffinity",
+			"ContactArea", "Random", "Constant"
+		};
+
+		for (const char* n : names)
+			if (name == n)
+				return true;
+
+		return false;
+	}
+
+	/**
+	 * Parse a template argument or a whole expression. Scoring functions are
+	 * compiled into the program and increase the stack depth, integers (and
+	 * true/false) are added to numbers, and type names (RegionGraphType,
+	 * ScoreValue) are skipped.
+	 */
+	void parseTerm(int& depth, int& maxDepth, bool scoringFunctionOnly, std::vector<int>* numbers = NULL) {
+
+		skipSpace();
+
+		std::size_t start = _pos;
+
+		if (_pos < _expression.size() && (std::isdigit(_expression[_pos]) || _expression[_pos] == '-')) {
+
+			_pos++;
+			while (_pos < _expression.size() && std::isdigit(_expression[_pos]))
+				_pos++;
+
+			if (scoringFunctionOnly || !numbers)
+				parseError("unexpected number");
+			numbers->push_back(std::atoi(_expression.substr(start, _pos - start).c_str()));
+			return;
+		}
+
+		while (_pos < _expression.size() && (std::isalnum(_expression[_pos]) || _expression[_pos] == '_'))
+			_pos++;
+		std::string name = _expression.substr(start, _pos - start);
+
+		if (name.empty())
+			parseError("expected a name");
+
+		if (!isScoringFunction(name)) {
+
+			if (scoringFunctionOnly)
+				parseError("unknown scoring function '" + name + "'");
+
+			if (name == "true" || name == "false") {
+
+				if (!numbers)
+					parseError("unexpected '" + name + "'");
+				numbers->push_back(name == "true");
+			}
+
+			// a type argument
+			return;
+		}
+
+		// parse template arguments
+		int numOperands = 0;
+		std::vector<int> args;
+		expect('<');
+		do {
+
+			int before = _program.size();
+			parseTerm(depth, maxDepth, false, &args);
+			if ((int)_program.size() > before)
+				numOperands++;
+
+		} while (accept(','));
+		expect('>');
+
+		compile(name, numOperands, args, depth, maxDepth);
+	}
+
+	void compile(const std::string& name, int numOperands, const std::vector<int>& args, int& depth, int& maxDepth) {
+
+		int expectedOperands = 0;
+		if (name == "OneMinus" || name == "Invert" || name == "Square")
+			expectedOperands = 1;
+		else if (name == "Add" || name == "Subtract" || name == "Multiply" || name == "Divide" || name == "Step")
+			expectedOperands = 2;
+
+		if (numOperands != expectedOperands)
+			parseError(name + " expects " + std::to_string(expectedOperands) + " scoring function argument(s)");
+
+		// number of integer arguments, optional InitWithMax
+		std::size_t minArgs = 0;
+		std::size_t maxArgs = 0;
+		if (name == "HistogramQuantileAffinity") {
+			minArgs = 2;
+			maxArgs = 3;
+		} else if (name == "QuantileAffinity") {
+			minArgs = 1;
+			maxArgs = 2;
+		} else if (name == "MeanMaxKAffinity" || name == "Constant") {
+			minArgs = maxArgs = 1;
+		}
+
+		if (args.size() < minArgs || args.size() > maxArgs)
+			parseError("wrong number of arguments for " + name);
+
+		if (name == "OneMinus") emit(OneMinusOp);
+		else if (name == "Invert") emit(InvertOp);
+		else if (name == "Square") emit(SquareOp);
+		else if (name == "Add") emit(AddOp);
+		else if (name == "Subtract") emit(SubtractOp);
+		else if (name == "Multiply") emit(MultiplyOp);
+		else if (name == "Divide") emit(DivideOp);
+		else if (name == "Step") emit(StepOp);
+		else if (name == "MinSize") emit(MinSizeOp, 0, provider<RegionSizeType>("RegionSize"));
+		else if (name == "MaxSize") emit(MaxSizeOp, 0, provider<RegionSizeType>("RegionSize"));
+		else if (name == "MinAffinity") emit(MinAffinityOp, 0, provider<MinAffinityType>("MinAffinity"));
+		else if (name == "MaxAffinity") emit(MaxAffinityOp, 0, provider<MaxAffinityType>("MaxAffinity"));
+		else if (name == "MeanAffinity") emit(MeanAffinityOp, 0, provider<MeanAffinityType>("MeanAffinity"));
+		else if (name == "ContactArea") emit(ContactAreaOp, 0, provider<ContactAreaType>("ContactArea"));
+		else if (name == "Random") emit(RandomOp);
+		else if (name == "Constant") emit(ConstantOp, args[0]);
+		else if (name == "HistogramQuantileAffinity") {
+
+			if (args[1] != HistogramBins)
+				parseError("only " + std::to_string(HistogramBins) + " bins are supported for HistogramQuantileAffinity");
+
+			// histograms do not depend on the quantile, share them
+			if (args.size() < 3 || args[2])
+				emit(HistogramQuantileOp, args[0], provider<HistogramQuantileType<true>>("HistogramQuantile"));
+			else
+				emit(HistogramQuantileAllOp, args[0], provider<HistogramQuantileType<false>>("HistogramQuantileAll"));
+
+		} else if (name == "QuantileAffinity") {
+
+			// values are partially sorted around the quantile, one provider
+			// per quantile
+			std::string q = std::to_string(args[0]);
+			if (args.size() < 2 || args[1])
+				emit(VectorQuantileOp, args[0], provider<VectorQuantileType<true>>("Quantile" + q, args[0]));
+			else
+				emit(VectorQuantileAllOp, args[0], provider<VectorQuantileType<false>>("QuantileAll" + q, args[0]));
+
+		} else if (name == "MeanMaxKAffinity") {
+
+			if (args[0] < 1 || args[0] > MaxK)
+				parseError("K has to be between 1 and " + std::to_string(MaxK) + " for MeanMaxKAffinity");
+
+			emit(MeanMaxKAffinityOp, args[0], provider<MaxKAffinityType>("MaxKAffinity"));
+		}
+
+		// leaves push a value, binary operators pop one
+		if (expectedOperands == 0)
+			depth++;
+		else if (expectedOperands == 2)
+			depth--;
+		maxDepth = std::max(maxDepth, depth);
+	}
+
+	RegionGraphType& _regionGraph;
+
+	std::string _expression;
+	std::size_t _pos;
+
+	std::vector<Instruction> _program;
+
+	// in order of creation, which is the same for the same expression
+	std::vector<std::unique_ptr<ProviderBase>> _providers;
+	std::map<std::string, const ProviderBase*> _providersByKey;
+};
+
+/**
+ * A scoring function given at runtime, see DynamicStatisticsProvider. Use as
+ * ScoringFunctionType to compile a module once for all scoring functions.
+ */
+template <typename RegionGraphType, typename Precision>
+class DynamicScoringFunction {
+
+public:
+
+	typedef DynamicStatisticsProvider<RegionGraphType, Precision> StatisticsProviderType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+	typedef Precision ScoreType;
+
+	DynamicScoringFunction(
+			RegionGraphType&,
+			const StatisticsProviderType& provider) :
+		_provider(provider) {}
+
+	inline ScoreType operator()(EdgeIdType e) {
+
+		return _provider.evaluate(e);
+	}
+
+private:
+
+	const StatisticsProviderType& _provider;
+};
+
+#endif // WATERZ_DYNAMIC_SCORING_FUNCTION_H__
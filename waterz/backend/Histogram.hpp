@@ -33,6 +33,13 @@ public:
 		_lowestBin = std::min(_lowestBin, i);
 	}
 
+	void inc(int i, T n) {
+
+		_bins[i] += n;
+		_sum += n;
+		_lowestBin = std::min(_lowestBin, i);
+	}
+
 	const T& operator[](int i) const { return _bins[i]; }
 
 	T sum() const { return _sum; }
@@ -35,6 +35,18 @@ public:
 		_histograms[e].inc(bin);
 	}
 
+	inline void addAffinities(EdgeIdType e, ValueType affinity, std::size_t count) {
+
+		// initial edges keep only their highest affinity
+		if (InitWithMax) {
+
+			addAffinity(e, affinity);
+			return;
+		}
+
+		_histograms[e].inc(discretize<int>(affinity, Bins), count);
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		_histograms[to] += _histograms[from];
@@ -45,8 +57,17 @@ public:
 
 	inline ValueType operator[](EdgeIdType e) const {
 
+		return quantile(e, Q);
+	}
+
+	/**
+	 * Get any quantile q of the affinities of edge e. The histograms do not 
+	 * depend on Q, only operator[] does.
+	 */
+	inline ValueType quantile(EdgeIdType e, int q) const {
+
 		// pivot element, 1-based index
-		int pivot = Q*_histograms[e].sum()/100 + 1;
+		int pivot = q*_histograms[e].sum()/100 + 1;
 
 		int sum = 0;
 		int bin = 0;
@@ -61,6 +82,21 @@ public:
 		return undiscretize<Precision>(bin, Bins);
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _histograms.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_histograms.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_histograms.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<Histogram<Bins>> _histograms;
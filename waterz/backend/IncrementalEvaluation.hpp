@@ -0,0 +1,230 @@
+#ifndef WATERZ_INCREMENTAL_EVALUATION_H__
+#define WATERZ_INCREMENTAL_EVALUATION_H__
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <math.h>
+
+#include "ContingencyTable.hpp"
+#include "Serialization.hpp"
+
+/**
+ * Keeps track of Rand and VOI split and merge of a segmentation compared to 
+ * ground-truth, while regions of the segmentation get merged.
+ *
+ * The overlap of each region with the ground-truth labels is computed once 
+ * from the initial segmentation. Since merging only unions regions, each merge 
+ * updates the contingency table (and the sums the metrics are computed from) 
+ * in time linear in the number of ground-truth labels overlapping the smaller 
+ * region.
+ */
+template <typename NodeIdType>
+class IncrementalEvaluation {
+
+public:
+
+	typedef ContingencyTable::LabelType LabelType;
+	typedef ContingencyTable::CountType CountType;
+
+	/**
+	 * Create an empty evaluation, to be restored from a checkpoint with load().
+	 */
+	IncrementalEvaluation() :
+		_total(0),
+		_sum_p_ij(0),
+		_sum_t_k(0),
+		_sum_s_k(0),
+		_nlogn_p_ij(0),
+		_nlogn_t(0),
+		_nlogn_s(0) {}
+
+	/**
+	 * Create an incremental evaluation for the given segmentation and 
+	 * ground-truth volumes. Voxels with ground-truth label 0 are ignored.
+	 */
+	template <typename V1, typename V2>
+	IncrementalEvaluation(
+			const V1& gt,
+			const V2& segmentation,
+			std::size_t numNodes) :
+		_overlaps(numNodes),
+		_sizes(numNodes, 0),
+		_total(0),
+		_sum_p_ij(0),
+		_sum_t_k(0),
+		_sum_s_k(0),
+		_nlogn_p_ij(0),
+		_nlogn_t(0),
+		_nlogn_s(0) {
+
+		ContingencyTable p_ij;
+		p_ij.addArrays(gt.data(), segmentation.data(), gt.num_elements());
+
+		std::vector<ContingencyTable::Entry> entries = p_ij.entries();
+
+		// ground-truth marginals
+		std::sort(entries.begin(), entries.end(),
+				[](const ContingencyTable::Entry& a, const ContingencyTable::Entry& b) { return a.i < b.i; });
+		CountType t = 0;
+		for (std::size_t k = 0; k < entries.size(); k++) {
+
+			t += entries[k].count;
+
+			if (k + 1 == entries.size() || entries[k + 1].i != entries[k].i) {
+
+				_sum_t_k += sqr(t);
+				_nlogn_t += nlogn(t);
+				t = 0;
+			}
+		}
+
+		// overlaps of regions with ground-truth labels, sorted by label
+		for (const ContingencyTable::Entry& e : entries) {
+
+			_overlaps[e.j].push_back(std::make_pair(e.i, e.count));
+			_sizes[e.j] += e.count;
+			_total += e.count;
+			_sum_p_ij += sqr(e.count);
+			_nlogn_p_ij += nlogn(e.count);
+		}
+
+		for (CountType s : _sizes) {
+
+			_sum_s_k += sqr(s);
+			_nlogn_s += nlogn(s);
+		}
+	}
+
+	/**
+	 * Region 'from' got merged into region 'to'.
+	 */
+	void notifyMerge(NodeIdType from, NodeIdType to) {
+
+		CountType s_from = _sizes[from];
+		CountType s_to   = _sizes[to];
+
+		_sum_s_k += sqr(s_from + s_to) - sqr(s_from) - sqr(s_to);
+		_nlogn_s += nlogn(s_from + s_to) - nlogn(s_from) - nlogn(s_to);
+
+		_sizes[to] = s_from + s_to;
+		_sizes[from] = 0;
+
+		Overlaps& a = _overlaps[to];
+		Overlaps& b = _overlaps[from];
+
+		// iterate over the smaller list of overlaps
+		if (a.size() < b.size())
+			a.swap(b);
+
+		std::size_t numSorted = a.size();
+
+		for (const std::pair<LabelType, CountType>& overlap : b) {
+
+			auto it = std::lower_bound(
+					a.begin(),
+					a.begin() + numSorted,
+					overlap,
+					[](const std::pair<LabelType, CountType>& x, const std::pair<LabelType, CountType>& y) { return x.first < y.first; });
+
+			CountType n = overlap.second;
+			CountType m = 0;
+
+			if (it != a.begin() + numSorted && it->first == overlap.first) {
+
+				m = it->second;
+				it->second += n;
+
+			} else {
+
+				a.push_back(overlap);
+			}
+
+			_sum_p_ij += sqr(n + m) - sqr(n) - sqr(m);
+			_nlogn_p_ij += nlogn(n + m) - nlogn(n) - nlogn(m);
+		}
+
+		if (numSorted < a.size())
+			std::inplace_merge(
+					a.begin(),
+					a.begin() + numSorted,
+					a.end(),
+					[](const std::pair<LabelType, CountType>& x, const std::pair<LabelType, CountType>& y) { return x.first < y.first; });
+
+		Overlaps().swap(b);
+	}
+
+	/**
+	 * Get Rand split, Rand merge, VOI split, and VOI merge of the current 
+	 * segmentation, in this order.
+	 */
+	std::tuple<double,double,double,double> metrics() const {
+
+		double rand_split = _sum_p_ij/_sum_t_k;
+		double rand_merge = _sum_p_ij/_sum_s_k;
+
+		// H(s|t) = H(s,t) - H(t), where H(x) = log(N) - sum(n*log(n))/N
+		double voi_split = (_nlogn_t - _nlogn_p_ij)/_total;
+		// H(t|s)
+		double voi_merge = (_nlogn_s - _nlogn_p_ij)/_total;
+
+		return std::make_tuple(
+				rand_split,
+				rand_merge,
+				voi_split,
+				voi_merge);
+	}
+
+	void save(BinaryWriter& out) const {
+
+		out.write(_overlaps);
+		out.write(_sizes);
+		out.write(_total);
+		out.write(_sum_p_ij);
+		out.write(_sum_t_k);
+		out.write(_sum_s_k);
+		out.write(_nlogn_p_ij);
+		out.write(_nlogn_t);
+		out.write(_nlogn_s);
+	}
+
+	void load(BinaryReader& in) {
+
+		in.read(_overlaps);
+		in.read(_sizes);
+		in.read(_total);
+		in.read(_sum_p_ij);
+		in.read(_sum_t_k);
+		in.read(_sum_s_k);
+		in.read(_nlogn_p_ij);
+		in.read(_nlogn_t);
+		in.read(_nlogn_s);
+	}
+
+private:
+
+	typedef std::vector<std::pair<LabelType, CountType>> Overlaps;
+
+	static inline double sqr(CountType n) { return (double)n*n; }
+
+	static inline double nlogn(CountType n) { return (n ? n*log2((double)n) : 0.0); }
+
+	// for each region, the number of voxels overlapping with each ground-truth 
+	// label
+	std::vector<Overlaps> _overlaps;
+
+	// the number of voxels of each region, not counting ground-truth 
+	// background
+	std::vector<CountType> _sizes;
+
+	double _total;
+	double _sum_p_ij;
+	double _sum_t_k;
+	double _sum_s_k;
+	double _nlogn_p_ij;
+	double _nlogn_t;
+	double _nlogn_s;
+};
+
+#endif // WATERZ_INCREMENTAL_EVALUATION_H__
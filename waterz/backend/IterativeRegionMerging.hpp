@@ -7,9 +7,12 @@
 #include <queue>
 #include <cassert>
 #include <limits>
+#include <algorithm>
 
 #include "RegionGraph.hpp"
 #include "PriorityQueue.hpp"
+#include "Serialization.hpp"
+#include "Telemetry.hpp"
 
 template <typename NodeIdType, typename ScoreType, template <typename T, typename S> class QueueType = PriorityQueue>
 class IterativeRegionMerging {
@@ -28,10 +31,14 @@ public:
 		_edgeScores(initialRegionGraph),
 		_deleted(initialRegionGraph),
 		_stale(initialRegionGraph),
-		_mergedUntil(std::numeric_limits<ScoreType>::lowest()) {}
+		_mergedUntil(std::numeric_limits<ScoreType>::lowest()),
+		_scored(false) {}
 
 	/**
-	 * Merge a RAG with the given edge scoring function until the given threshold.
+	 * Merge a RAG with the given edge scoring function until the given 
+	 * threshold, or until visitor.stop() returns true. The latter is checked 
+	 * before each merge. If merging was stopped early, the state is considered 
+	 * to be merged until the score of the last merge.
 	 */
 	template <typename EdgeScoringFunction, typename StatisticsProviderType, typename Visitor>
 	std::size_t mergeUntil(
@@ -42,28 +49,30 @@ public:
 
 		if (threshold <= _mergedUntil) {
 
-			std::cout << "already merged until " << threshold << ", skipping" << std::endl;
+			WATERZ_LOG_DEBUG("already merged until " << threshold << ", skipping");
 			return 0;
 		}
 
-		// compute scores of each edge not scored so far
-		if (_mergedUntil == std::numeric_limits<ScoreType>::lowest()) {
+		scoreEdges(edgeScoringFunction);
 
-			std::cout << "computing initial scores" << std::endl;
-
-			for (EdgeIdType e = 0; e < _regionGraph.edges().size(); e++)
-				scoreEdge(e, edgeScoringFunction);
-		}
-
-		std::cout << "merging until " << threshold << std::endl;
+		WATERZ_LOG_DEBUG("merging until " << threshold);
 
 		if (!_edgeQueue.empty())
-			std::cout << "min edge score " << _edgeScores[_edgeQueue.top()] << std::endl;
+			WATERZ_LOG_DEBUG("min edge score " << _edgeScores[_edgeQueue.top()]);
 
 		// while there are still unhandled edges
 		std::size_t merged = 0;
+		bool stopped = false;
+		ScoreType lastScore = _mergedUntil;
 		while (!_edgeQueue.empty()) {
 
+			if (visitor.stop()) {
+
+				WATERZ_LOG_DEBUG("stop criterion reached");
+				stopped = true;
+				break;
+			}
+
 			// get the next cheapest edge to merge
 			EdgeIdType next = _edgeQueue.top();
 			ScoreType score = _edgeScores[next];
@@ -73,7 +82,7 @@ public:
 			// more expensive)
 			if (score >= threshold) {
 
-				std::cout << "threshold exceeded" << std::endl;
+				WATERZ_LOG_DEBUG("threshold exceeded");
 				break;
 			}
 
@@ -102,6 +111,7 @@ public:
 
 			NodeIdType newRegion = mergeRegions(next, statisticsProvider);
 			merged++;
+			lastScore = score;
 
 			visitor.onMerge(
 					_regionGraph.edge(next).u,
@@ -110,13 +120,114 @@ public:
 					score);
 		}
 
-		std::cout << "merged " << merged << " edges" << std::endl;
+		WATERZ_LOG_DEBUG("merged " << merged << " edges");
 
-		_mergedUntil = threshold;
+		_mergedUntil = (stopped ? std::max(lastScore, _mergedUntil) : threshold);
 
 		return merged;
 	}
 
+	/**
+	 * Compute the initial scores of all edges, if not done already. This 
+	 * happens in the first call to mergeUntil(), call it before to time it 
+	 * separately. Returns true if the edges were scored in this call.
+	 */
+	template <typename EdgeScoringFunction>
+	bool scoreEdges(EdgeScoringFunction& edgeScoringFunction) {
+
+		if (_scored)
+			return false;
+
+		WATERZ_LOG_DEBUG("computing initial scores");
+
+		for (EdgeIdType e = 0; e < _regionGraph.edges().size(); e++)
+			scoreEdge(e, edgeScoringFunction);
+
+		_scored = true;
+
+		return true;
+	}
+
+	/**
+	 * Bytes allocated for edge scores, edge flags, and the merge-tree. The 
+	 * queue is accounted for separately, see queueMemoryUsage().
+	 */
+	std::size_t memoryUsage() const {
+
+		return
+				_edgeScores.memoryUsage() +
+				_stale.memoryUsage() +
+				_deleted.memoryUsage() +
+				allocatedBytes(_rootPaths);
+	}
+
+	/**
+	 * The number of edges in the queue, including stale and deleted ones.
+	 */
+	std::size_t queueSize() const {
+
+		return _edgeQueue.size();
+	}
+
+	/**
+	 * Bytes allocated by the queue of edges.
+	 */
+	std::size_t queueMemoryUsage() const {
+
+		return _edgeQueue.memoryUsage();
+	}
+
+	/**
+	 * Estimate the peak of memoryUsage() for a region graph of numNodes nodes 
+	 * and numEdges edges, merged into a single region.
+	 */
+	static std::size_t estimateMemoryUsage(std::size_t numNodes, std::size_t numEdges) {
+
+		return
+				numEdges*sizeof(ScoreType) +
+				2*((numEdges + 63)/64)*8 +
+				numNodes*(4*sizeof(void*) + sizeof(std::pair<const NodeIdType, NodeIdType>));
+	}
+
+	/**
+	 * Estimate the peak of queueMemoryUsage(), which is reached after all 
+	 * numEdges edges have been scored.
+	 */
+	static std::size_t estimateQueueMemoryUsage(std::size_t numEdges) {
+
+		return QueueType<EdgeIdType, ScoreType>::estimateMemoryUsage(numEdges);
+	}
+
+	/**
+	 * Write the current state of merging to a checkpoint. The region graph and 
+	 * statistics providers have to be saved separately.
+	 */
+	void save(BinaryWriter& out) const {
+
+		_edgeScores.save(out);
+		_stale.save(out);
+		_deleted.save(out);
+		_edgeQueue.save(out);
+		out.write(_rootPaths);
+		out.write(_mergedUntil);
+		out.write(_scored);
+	}
+
+	/**
+	 * Restore the state of merging from a checkpoint, after the region graph 
+	 * has been restored.
+	 */
+	void load(BinaryReader& in) {
+
+		_edgeScores.load(in);
+		_stale.load(in);
+		_deleted.load(in);
+		_edgeQueue.load(in);
+		in.read(_rootPaths);
+		in.read(_mergedUntil);
+		in.read(_scored);
+	}
+
 	/**
 	 * Get the segmentation corresponding to the current merge level.
 	 *
@@ -328,6 +439,9 @@ private:
 
 	// current state of merging
 	ScoreType _mergedUntil;
+
+	// whether the initial edge scores have been computed
+	bool _scored;
 };
 
 #endif // ITERATIVE_REGION_MERGING_H__
@@ -21,6 +21,11 @@ public:
 		_maxAffinities[e] = std::max(_maxAffinities[e], affinity);
 	}
 
+	inline void addAffinities(EdgeIdType e, ValueType affinity, std::size_t /*count*/) {
+
+		addAffinity(e, affinity);
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		if (_maxAffinities[to] >= _maxAffinities[from])
@@ -38,6 +43,21 @@ public:
 		return _maxAffinities[e];
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _maxAffinities.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_maxAffinities.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_maxAffinities.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<ValueType> _maxAffinities;
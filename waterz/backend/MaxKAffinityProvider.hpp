@@ -1,6 +1,8 @@
 #ifndef WATERZ_MAX_K_AFFINITY_PROVIDER_H__
 #define WATERZ_MAX_K_AFFINITY_PROVIDER_H__
 
+#include <algorithm>
+
 #include "MaxKValues.hpp"
 #include "StatisticsProvider.hpp"
 
@@ -20,6 +22,13 @@ public:
 		_maxKValues[e].push(affinity);
 	}
 
+	inline void addAffinities(EdgeIdType e, Precision affinity, std::size_t count) {
+
+		// more than K equal values do not change the max K
+		for (std::size_t i = 0; i < std::min(count, (std::size_t)K); i++)
+			_maxKValues[e].push(affinity);
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		_maxKValues[to].merge(_maxKValues[from]);
@@ -31,6 +40,21 @@ public:
 		return _maxKValues[e];
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _maxKValues.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_maxKValues.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_maxKValues.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<MaxKValues<Precision,K>> _maxKValues;
@@ -58,9 +58,17 @@ public:
 
 	T average() const {
 
+		return average(K);
+	}
+
+	/**
+	 * Get the average of the max n <= K values.
+	 */
+	T average(int n) const {
+
 		T sum = 0;
 		int k;
-		for (k = 0; k < K; k++) {
+		for (k = 0; k < n; k++) {
 			if (_values[k] == std::numeric_limits<T>::lowest())
 				break;
 			sum += _values[k];
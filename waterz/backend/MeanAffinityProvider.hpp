@@ -27,6 +27,15 @@ public:
 		_numValues[e]++;
 	}
 
+	inline void addAffinities(EdgeIdType e, ValueType affinity, std::size_t count) {
+
+		size_t n = _numValues[e];
+		Precision mean = _meanAffinities[e];
+
+		_meanAffinities[e] = (affinity*count + mean*n)/(n + count);
+		_numValues[e] += count;
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		size_t fromN = _numValues[from];
@@ -46,6 +55,25 @@ public:
 		return _meanAffinities[e];
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return
+				_numValues.memoryUsage() +
+				_meanAffinities.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_numValues.save(out);
+		_meanAffinities.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_numValues.load(in);
+		_meanAffinities.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<size_t> _numValues;
@@ -0,0 +1,170 @@
+#ifndef WATERZ_MEMORY_USAGE_H__
+#define WATERZ_MEMORY_USAGE_H__
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Telemetry.hpp"
+
+/**
+ * Bytes allocated on the heap by a value, not counting sizeof(value) itself.
+ * Vectors are counted by their capacity, node-based containers are estimated
+ * as allocated by libstdc++.
+ */
+template <typename T>
+inline std::size_t allocatedBytes(const T&) { return 0; }
+
+// declared before any definition, such that nested containers find each other
+inline std::size_t allocatedBytes(const std::vector<bool>& values);
+template <typename T>
+inline std::size_t allocatedBytes(const std::vector<T>& values);
+template <typename T>
+inline std::size_t allocatedBytes(const std::deque<T>& values);
+template <typename K, typename V>
+inline std::size_t allocatedBytes(const std::map<K, V>& values);
+
+inline std::size_t
+allocatedBytes(const std::vector<bool>& values) {
+
+	return values.capacity()/8;
+}
+
+template <typename T>
+inline std::size_t
+allocatedBytes(const std::vector<T>& values) {
+
+	std::size_t bytes = values.capacity()*sizeof(T);
+
+	if (!std::is_trivially_copyable<T>::value)
+		for (const T& value : values)
+			bytes += allocatedBytes(value);
+
+	return bytes;
+}
+
+template <typename T>
+inline std::size_t
+allocatedBytes(const std::deque<T>& values) {
+
+	// blocks of 512 bytes (at least one element), and a map of at least 8
+	// block pointers, even if empty
+	std::size_t blockSize = std::max<std::size_t>(512/sizeof(T), 1)*sizeof(T);
+	std::size_t numBlocks = values.size()*sizeof(T)/blockSize + 1;
+
+	std::size_t bytes =
+			numBlocks*blockSize +
+			std::max<std::size_t>(numBlocks + 2, 8)*sizeof(void*);
+
+	if (!std::is_trivially_copyable<T>::value)
+		for (const T& value : values)
+			bytes += allocatedBytes(value);
+
+	return bytes;
+}
+
+template <typename K, typename V>
+inline std::size_t
+allocatedBytes(const std::map<K, V>& values) {
+
+	// each tree node holds its color, three pointers, and the key-value pair
+	std::size_t bytes = values.size()*(4*sizeof(void*) + sizeof(std::pair<const K, V>));
+
+	if (!std::is_trivially_copyable<V>::value)
+		for (const auto& pair : values)
+			bytes += allocatedBytes(pair.second);
+
+	return bytes;
+}
+
+/**
+ * The capacity of a vector after n push_back()s, starting empty.
+ */
+inline std::size_t
+grownCapacity(std::size_t n) {
+
+	std::size_t capacity = 1;
+	while (capacity < n)
+		capacity *= 2;
+
+	return (n == 0 ? 0 : capacity);
+}
+
+/**
+ * Current and peak bytes of a component.
+ */
+struct ComponentMemory {
+
+	std::string component;
+	std::size_t bytes;
+	std::size_t peakBytes;
+};
+
+/**
+ * Collects the bytes allocated by components (e.g., the region graph, the
+ * statistics provider, or the queue) between the stages of processing. The
+ * peak of a component is the maximum of its records, the peak total the
+ * maximum sum of components recorded at the same time.
+ */
+class MemoryAccounting {
+
+public:
+
+	MemoryAccounting() :
+		_totalBytes(0),
+		_peakTotalBytes(0) {}
+
+	/**
+	 * Record the current bytes of a component.
+	 */
+	void record(const std::string& component, std::size_t bytes) {
+
+		ComponentMemory& memory = get(component);
+
+		_totalBytes = _totalBytes - memory.bytes + bytes;
+		_peakTotalBytes = std::max(_peakTotalBytes, _totalBytes);
+
+		memory.bytes = bytes;
+		memory.peakBytes = std::max(memory.peakBytes, bytes);
+
+		WATERZ_LOG_DEBUG(component << ": " << bytes << " bytes");
+	}
+
+	/**
+	 * Record the peak bytes of a component that is freed again before the next
+	 * record, like temporary buffers.
+	 */
+	void recordTransient(const std::string& component, std::size_t peakBytes) {
+
+		record(component, peakBytes);
+		record(component, 0);
+	}
+
+	const std::vector<ComponentMemory>& components() const { return _components; }
+
+	std::size_t totalBytes() const { return _totalBytes; }
+
+	std::size_t peakTotalBytes() const { return _peakTotalBytes; }
+
+private:
+
+	ComponentMemory& get(const std::string& component) {
+
+		for (ComponentMemory& memory : _components)
+			if (memory.component == component)
+				return memory;
+
+		_components.push_back({component, 0, 0});
+		return _components.back();
+	}
+
+	std::vector<ComponentMemory> _components;
+
+	std::size_t _totalBytes;
+	std::size_t _peakTotalBytes;
+};
+
+#endif // WATERZ_MEMORY_USAGE_H__
@@ -21,6 +21,11 @@ public:
 		_minAffinities[e] = std::min(_minAffinities[e], affinity);
 	}
 
+	inline void addAffinities(EdgeIdType e, ValueType affinity, std::size_t /*count*/) {
+
+		addAffinity(e, affinity);
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		if (_minAffinities[to] <= _minAffinities[from])
@@ -38,6 +43,21 @@ public:
 		return _minAffinities[e];
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _minAffinities.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_minAffinities.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_minAffinities.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<ValueType> _minAffinities;
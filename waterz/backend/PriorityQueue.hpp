@@ -1,6 +1,13 @@
 #ifndef WATERZ_PRIORITY_QUEUE_H__
 #define WATERZ_PRIORITY_QUEUE_H__
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "Serialization.hpp"
+#include "MemoryUsage.hpp"
+
 template <typename T, typename ScoreType>
 class PriorityQueue {
 
@@ -10,27 +17,59 @@ public:
 
 	void push(const T& element, ScoreType score) {
 
-		_queue.push({element, score});
+		_heap.push_back({element, score});
+		std::push_heap(_heap.begin(), _heap.end(), std::greater<Entry>());
 	}
 
 	const T& top() const {
 
-		return _queue.top().element;
+		return _heap.front().element;
 	}
 
 	void pop() {
 
-		_queue.pop();
+		std::pop_heap(_heap.begin(), _heap.end(), std::greater<Entry>());
+		_heap.pop_back();
 	}
 
 	bool empty() const {
 
-		return _queue.empty();
+		return _heap.empty();
 	}
 
 	size_t size() const {
 
-		return _queue.size();
+		return _heap.size();
+	}
+
+	/**
+	 * Bytes allocated for the heap.
+	 */
+	std::size_t memoryUsage() const {
+
+		return allocatedBytes(_heap);
+	}
+
+	/**
+	 * Estimate memoryUsage() for a queue of numElements elements.
+	 */
+	static std::size_t estimateMemoryUsage(std::size_t numElements) {
+
+		return grownCapacity(numElements)*sizeof(Entry);
+	}
+
+	/**
+	 * Write the heap as it is, such that a restored queue pops elements in 
+	 * exactly the same order, also for elements of equal score.
+	 */
+	void save(BinaryWriter& out) const {
+
+		out.write(_heap);
+	}
+
+	void load(BinaryReader& in) {
+
+		in.read(_heap);
 	}
 
 private:
@@ -45,9 +84,10 @@ private:
 		}
 	};
 
-	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> _queue;
+	// a binary min-heap, kept as a plain vector (instead of a 
+	// std::priority_queue) to be able to save it
+	std::vector<Entry> _heap;
 };
 
 
 #endif // WATERZ_PRIORITY_QUEUE_H__
-
@@ -0,0 +1,161 @@
+#ifndef WATERZ_PROGRESS_H__
+#define WATERZ_PROGRESS_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+/**
+ * The state of a long-running stage, passed to a ProgressCallback.
+ */
+struct Progress {
+
+	// "watershed", "region_graph", "scoring", or "merging"
+	const char* stage;
+
+	// watershed: voxels processed in the current pass, region graph: sections 
+	// (or given edges) processed, merging: merges done
+	std::size_t done;
+
+	// the number of voxels, sections, or given edges, 0 for scoring and 
+	// merging
+	std::size_t total;
+
+	// merging: the score of the last edge taken from the queue
+	double minScore;
+
+	// merging: number of edges in the queue
+	std::size_t queueSize;
+
+	// seconds since the start of the stage
+	double seconds;
+};
+
+/**
+ * Receives progress reports, see ProgressReporter. Return false to cancel.
+ */
+typedef bool (*ProgressCallback)(const Progress& progress, void* data);
+
+/**
+ * Thrown if processing got cancelled before a consistent state was reached,
+ * i.e., during initialization.
+ */
+class Cancelled : public std::runtime_error {
+
+public:
+
+	Cancelled() : std::runtime_error("cancelled") {}
+};
+
+/**
+ * Calls a ProgressCallback at most every intervalSeconds from the loops of
+ * long-running stages, and holds a cancellation flag they check. The flag is
+ * set if the callback returns false, or by cancel(), which can be called from
+ * any thread (and from signal handlers).
+ *
+ * Loops call due() once per iteration, and report() if it returns true. The
+ * clock is read only every CheckEvery calls of due().
+ */
+class ProgressReporter {
+
+public:
+
+	static const std::size_t CheckEvery = 1024;
+
+	ProgressReporter(
+			ProgressCallback callback = NULL,
+			void*            data = NULL,
+			double           intervalSeconds = 1.0) :
+		_callback(callback),
+		_data(data),
+		_interval(intervalSeconds),
+		_calls(0),
+		_cancelled(false) {
+
+		start("");
+	}
+
+	/**
+	 * Start a new stage. Does not report.
+	 */
+	void start(const char* stage) {
+
+		_stage = stage;
+		_start = _last = std::chrono::steady_clock::now();
+	}
+
+	/**
+	 * Check whether the interval passed since the last report.
+	 */
+	bool due() {
+
+		if (!_callback || ++_calls % CheckEvery != 0)
+			return false;
+
+		auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration<double>(now - _last).count() < _interval)
+			return false;
+
+		return true;
+	}
+
+	/**
+	 * Report the progress of the current stage. Returns true if processing 
+	 * should be cancelled.
+	 */
+	bool report(
+			std::size_t done,
+			std::size_t total = 0,
+			double      minScore = 0,
+			std::size_t queueSize = 0) {
+
+		_last = std::chrono::steady_clock::now();
+
+		Progress progress;
+		progress.stage     = _stage;
+		progress.done      = done;
+		progress.total     = total;
+		progress.minScore  = minScore;
+		progress.queueSize = queueSize;
+		progress.seconds   = std::chrono::duration<double>(_last - _start).count();
+
+		if (_callback && !_callback(progress, _data))
+			cancel();
+
+		return cancelled();
+	}
+
+	/**
+	 * For stages that can not be left in a consistent state: report if due, 
+	 * and throw Cancelled if processing should be cancelled.
+	 */
+	void check(std::size_t done, std::size_t total = 0) {
+
+		if (due())
+			report(done, total);
+
+		if (cancelled())
+			throw Cancelled();
+	}
+
+	void cancel() { _cancelled.store(true, std::memory_order_relaxed); }
+
+	bool cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+private:
+
+	ProgressCallback _callback;
+	void*            _data;
+	double           _interval;
+
+	const char* _stage;
+	std::chrono::steady_clock::time_point _start;
+	std::chrono::steady_clock::time_point _last;
+
+	std::size_t _calls;
+
+	std::atomic<bool> _cancelled;
+};
+
+#endif // WATERZ_PROGRESS_H__
@@ -6,6 +6,9 @@
 #include <limits>
 #include <cassert>
 
+#include "Serialization.hpp"
+#include "MemoryUsage.hpp"
+
 template <typename ID>
 struct RegionGraphEdge {
 
@@ -75,6 +78,12 @@ public:
 	inline typename Container::const_reference operator[](ID i) const { return _values[i]; }
 	inline typename Container::reference operator[](ID i) { return _values[i]; }
 
+	void save(BinaryWriter& out) const { out.write(_values); }
+
+	void load(BinaryReader& in) { in.read(_values); }
+
+	std::size_t memoryUsage() const { return allocatedBytes(_values); }
+
 private:
 
 	void onNewNode(ID id) {
@@ -134,6 +143,12 @@ public:
 	inline typename Container::const_reference operator[](std::size_t i) const { return _values[i]; }
 	inline typename Container::reference operator[](std::size_t i) { return _values[i]; }
 
+	void save(BinaryWriter& out) const { out.write(_values); }
+
+	void load(BinaryReader& in) { in.read(_values); }
+
+	std::size_t memoryUsage() const { return allocatedBytes(_values); }
+
 private:
 
 	void onNewEdge(std::size_t id) {
@@ -292,6 +307,50 @@ public:
 		return NoEdge;
 	}
 
+	/**
+	 * Bytes allocated for nodes and edges. Node and edge maps are not 
+	 * included, they are accounted for by their owners.
+	 */
+	std::size_t memoryUsage() const {
+
+		return allocatedBytes(_edges) + allocatedBytes(_incEdges);
+	}
+
+	/**
+	 * Estimate memoryUsage() of a region graph that was created with numNodes 
+	 * nodes, followed by numEdges calls to addEdge().
+	 */
+	static std::size_t estimateMemoryUsage(std::size_t numNodes, std::size_t numEdges) {
+
+		std::size_t degree = (numNodes == 0 ? 0 : (2*numEdges + numNodes - 1)/numNodes);
+
+		return
+				grownCapacity(numEdges)*sizeof(EdgeType) +
+				numNodes*(sizeof(std::vector<EdgeIdType>) + grownCapacity(degree)*sizeof(EdgeIdType));
+	}
+
+	/**
+	 * Write nodes and edges to a checkpoint. Node and edge maps are not 
+	 * included, they are saved by their owners.
+	 */
+	void save(BinaryWriter& out) const {
+
+		out.write(_numNodes);
+		out.write(_edges);
+		out.write(_incEdges);
+	}
+
+	/**
+	 * Restore nodes and edges from a checkpoint. Node and edge maps are not 
+	 * notified, their owners have to restore them as well.
+	 */
+	void load(BinaryReader& in) {
+
+		in.read(_numNodes);
+		in.read(_edges);
+		in.read(_incEdges);
+	}
+
 private:
 
 	friend RegionGraphNodeMapBase<ID>;
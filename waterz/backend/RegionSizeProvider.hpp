@@ -16,6 +16,11 @@ public:
 		_regionSizes[n]++;
 	}
 
+	inline void addVoxels(NodeIdType n, std::size_t count) {
+
+		_regionSizes[n] += count;
+	}
+
 	inline bool notifyNodeMerge(NodeIdType from, NodeIdType to) {
 
 		_regionSizes[to] += _regionSizes[from];
@@ -29,6 +34,21 @@ public:
 		return _regionSizes[n];
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _regionSizes.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_regionSizes.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_regionSizes.load(in);
+	}
+
 private:
 
 	typename RegionGraphType::template NodeMap<ValueType> _regionSizes;
@@ -0,0 +1,327 @@
+#ifndef WATERZ_SERIALIZATION_H__
+#define WATERZ_SERIALIZATION_H__
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Writes values and containers of plain-old-data types to a binary file.
+ * Containers are written as their size, followed by their elements.
+ */
+class BinaryWriter {
+
+public:
+
+	BinaryWriter(const std::string& filename) :
+		_file(filename, std::ios::binary | std::ios::trunc) {
+
+		if (!_file)
+			throw std::runtime_error("can not open " + filename + " for writing");
+	}
+
+	void write(const void* data, std::size_t bytes) {
+
+		_file.write(static_cast<const char*>(data), bytes);
+
+		if (!_file)
+			throw std::runtime_error("error while writing checkpoint");
+	}
+
+	template <typename T>
+	void write(const T& value) {
+
+		static_assert(std::is_standard_layout<T>::value, "only plain-old-data can be written");
+		write(&value, sizeof(T));
+	}
+
+	void write(const std::string& value) {
+
+		write(uint64_t(value.size()));
+		write(value.data(), value.size());
+	}
+
+	template <typename T>
+	void write(const std::vector<T>& values) {
+
+		static_assert(std::is_standard_layout<T>::value, "only plain-old-data can be written");
+		write(uint64_t(values.size()));
+		write(values.data(), values.size()*sizeof(T));
+	}
+
+	void write(const std::vector<bool>& values) {
+
+		std::vector<uint8_t> bytes(values.begin(), values.end());
+		write(bytes);
+	}
+
+	template <typename T>
+	void write(const std::vector<std::vector<T>>& values) {
+
+		write(uint64_t(values.size()));
+		for (const auto& value : values)
+			write(value);
+	}
+
+	template <typename K, typename V>
+	void write(const std::map<K, V>& values) {
+
+		write(uint64_t(values.size()));
+		for (const auto& pair : values) {
+
+			write(pair.first);
+			write(pair.second);
+		}
+	}
+
+	/**
+	 * Flush all data to the file.
+	 */
+	void close() {
+
+		_file.close();
+
+		if (!_file)
+			throw std::runtime_error("error while writing checkpoint");
+	}
+
+private:
+
+	std::ofstream _file;
+};
+
+/**
+ * A read-only memory mapping of a whole file.
+ */
+class MappedFile {
+
+public:
+
+	MappedFile(const std::string& filename) :
+		_data(NULL),
+		_size(0) {
+
+#ifdef _WIN32
+
+		_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (_file == INVALID_HANDLE_VALUE)
+			throw std::runtime_error("can not open " + filename);
+
+		LARGE_INTEGER size;
+		GetFileSizeEx(_file, &size);
+		_size = size.QuadPart;
+
+		_mapping = NULL;
+		if (_size > 0) {
+
+			_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (_mapping)
+				_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!_data) {
+
+				if (_mapping)
+					CloseHandle(_mapping);
+				CloseHandle(_file);
+				throw std::runtime_error("can not map " + filename);
+			}
+		}
+
+#else
+
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("can not open " + filename);
+
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+
+			::close(fd);
+			throw std::runtime_error("can not stat " + filename);
+		}
+		_size = info.st_size;
+
+		if (_size > 0) {
+
+			void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED) {
+
+				::close(fd);
+				throw std::runtime_error("can not map " + filename);
+			}
+
+			_data = static_cast<const char*>(data);
+		}
+
+		// the mapping stays valid without the file descriptor
+		::close(fd);
+
+#endif
+	}
+
+	~MappedFile() {
+
+#ifdef _WIN32
+		if (_data)
+			UnmapViewOfFile(_data);
+		if (_mapping)
+			CloseHandle(_mapping);
+		CloseHandle(_file);
+#else
+		if (_data)
+			munmap(const_cast<char*>(_data), _size);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * Tell the OS that the file will be read front to back.
+	 */
+	void adviseSequential() {
+
+#ifndef _WIN32
+		if (_data)
+			madvise(const_cast<char*>(_data), _size, MADV_SEQUENTIAL);
+#endif
+	}
+
+	const char* data() const { return _data; }
+
+	std::size_t size() const { return _size; }
+
+private:
+
+#ifdef _WIN32
+	HANDLE _file;
+	HANDLE _mapping;
+#endif
+
+	const char* _data;
+	std::size_t _size;
+};
+
+/**
+ * Reads what was written with a BinaryWriter. The file is memory-mapped, such
+ * that large arrays are copied directly from the page cache into their
+ * destination.
+ */
+class BinaryReader {
+
+public:
+
+	BinaryReader(const std::string& filename) :
+		_file(filename),
+		_data(_file.data()),
+		_size(_file.size()),
+		_pos(0) {
+
+		// the whole file will be read front to back
+		_file.adviseSequential();
+	}
+
+	void read(void* data, std::size_t bytes) {
+
+		if (bytes > _size - _pos)
+			throw std::runtime_error("checkpoint is truncated");
+
+		std::memcpy(data, _data + _pos, bytes);
+		_pos += bytes;
+	}
+
+	template <typename T>
+	void read(T& value) {
+
+		static_assert(std::is_standard_layout<T>::value, "only plain-old-data can be read");
+		read(&value, sizeof(T));
+	}
+
+	void read(std::string& value) {
+
+		value.resize(readSize(1));
+		read(&value[0], value.size());
+	}
+
+	template <typename T>
+	void read(std::vector<T>& values) {
+
+		static_assert(std::is_standard_layout<T>::value, "only plain-old-data can be read");
+		values.resize(readSize(sizeof(T)));
+		read(values.data(), values.size()*sizeof(T));
+	}
+
+	void read(std::vector<bool>& values) {
+
+		std::vector<uint8_t> bytes;
+		read(bytes);
+		values.assign(bytes.begin(), bytes.end());
+	}
+
+	template <typename T>
+	void read(std::vector<std::vector<T>>& values) {
+
+		values.resize(readSize(sizeof(uint64_t)));
+		for (auto& value : values)
+			read(value);
+	}
+
+	template <typename K, typename V>
+	void read(std::map<K, V>& values) {
+
+		values.clear();
+
+		std::size_t size = readSize(sizeof(K) + sizeof(V));
+		for (std::size_t i = 0; i < size; i++) {
+
+			K key;
+			V value;
+			read(key);
+			read(value);
+
+			// keys were written in order
+			values.emplace_hint(values.end(), key, value);
+		}
+	}
+
+private:
+
+	/**
+	 * Read the size of a container, and make sure it fits into the remaining
+	 * file, with elements of at least the given size.
+	 */
+	std::size_t readSize(std::size_t elementSize) {
+
+		uint64_t size;
+		read(size);
+
+		if (elementSize > 0 && size > (_size - _pos)/elementSize)
+			throw std::runtime_error("checkpoint is truncated");
+
+		return size;
+	}
+
+	MappedFile _file;
+
+	const char* _data;
+	std::size_t _size;
+	std::size_t _pos;
+};
+
+#endif // WATERZ_SERIALIZATION_H__
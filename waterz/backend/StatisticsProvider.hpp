@@ -1,6 +1,8 @@
 #ifndef WATERZ_STATISTICS_PROVIDER_H__
 #define WATERZ_STATISTICS_PROVIDER_H__
 
+#include "Serialization.hpp"
+
 /**
  * Base class for statistics providers with fallback implementations.
  */
@@ -21,9 +23,24 @@ public:
 	template <typename EdgeIdType, typename ScoreType>
 	inline void addAffinity(EdgeIdType e, ScoreType affinity) {}
 
+	/**
+	 * Callback for adding count voxel-level affinities of the same value to an 
+	 * edge at once. Used for region graphs that are given with precomputed 
+	 * statistics instead of a volume, with affinity being the representative 
+	 * affinity of the edge and count its contact area.
+	 */
+	template <typename EdgeIdType, typename ScoreType>
+	inline void addAffinities(EdgeIdType /*e*/, ScoreType /*affinity*/, std::size_t /*count*/) {}
+
 	template <typename NodeIdType>
 	inline void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) {}
 
+	/**
+	 * Callback for adding count voxels to a node at once.
+	 */
+	template <typename NodeIdType>
+	inline void addVoxels(NodeIdType /*n*/, std::size_t /*count*/) {}
+
 	/**
 	 * Callback for node merges: 'from' will be merged into 'to'. Return true, 
 	 * if this changed the statistics of this provider.
@@ -37,6 +54,21 @@ public:
 	 */
 	template<typename EdgeIdType>
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) { return false; }
+
+	/**
+	 * Bytes allocated for the statistics, for providers with a state.
+	 */
+	inline std::size_t memoryUsage() const { return 0; }
+
+	/**
+	 * Write the statistics to a checkpoint, for providers with a state.
+	 */
+	inline void save(BinaryWriter& out) const {}
+
+	/**
+	 * Restore the statistics from a checkpoint.
+	 */
+	inline void load(BinaryReader& in) {}
 };
 
 #endif // WATERZ_STATISTICS_PROVIDER_H__
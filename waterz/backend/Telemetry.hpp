@@ -0,0 +1,184 @@
+#ifndef WATERZ_TELEMETRY_H__
+#define WATERZ_TELEMETRY_H__
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/**
+ * Log levels, messages of a level are shown if the current level is at least
+ * as high. The default level is LOG_LEVEL_SILENT.
+ */
+enum LogLevel {
+
+	LOG_LEVEL_SILENT  = 0,
+	LOG_LEVEL_ERROR   = 1,
+	LOG_LEVEL_WARNING = 2,
+	LOG_LEVEL_INFO    = 3,
+	LOG_LEVEL_DEBUG   = 4
+};
+
+/**
+ * Receives log messages instead of stderr, see setLogSink(). Called from the
+ * thread that logs, possibly concurrently.
+ */
+typedef void (*LogSink)(int level, const char* message);
+
+class Log {
+
+public:
+
+	static bool enabled(int level) {
+
+		return level <= state().level.load(std::memory_order_relaxed);
+	}
+
+	static void setLevel(int level) {
+
+		state().level.store(level, std::memory_order_relaxed);
+	}
+
+	static void setSink(LogSink sink) {
+
+		state().sink.store(sink);
+	}
+
+	static void write(int level, const std::string& message) {
+
+		LogSink sink = state().sink.load();
+		if (sink) {
+
+			sink(level, message.c_str());
+			return;
+		}
+
+		// one line at a time, such that messages of threads do not interleave
+		std::lock_guard<std::mutex> lock(state().mutex);
+		std::cerr << "waterz: " << message << '\n';
+	}
+
+private:
+
+	struct State {
+
+		State() : level(LOG_LEVEL_SILENT), sink(NULL) {}
+
+		std::atomic<int>     level;
+		std::atomic<LogSink> sink;
+		std::mutex           mutex;
+	};
+
+	static State& state() {
+
+		static State state;
+		return state;
+	}
+};
+
+/**
+ * Log a message, composed with operator<<. The message is only composed if the
+ * level is enabled, such that disabled messages cost a single comparison.
+ */
+#define WATERZ_LOG(level, message) \
+	do { \
+		if (Log::enabled(level)) { \
+			std::ostringstream waterzLogStream; \
+			waterzLogStream << message; \
+			Log::write(level, waterzLogStream.str()); \
+		} \
+	} while (false)
+
+#define WATERZ_LOG_ERROR(message)   WATERZ_LOG(LOG_LEVEL_ERROR, message)
+#define WATERZ_LOG_WARNING(message) WATERZ_LOG(LOG_LEVEL_WARNING, message)
+#define WATERZ_LOG_INFO(message)    WATERZ_LOG(LOG_LEVEL_INFO, message)
+#define WATERZ_LOG_DEBUG(message)   WATERZ_LOG(LOG_LEVEL_DEBUG, message)
+
+inline void setLogLevel(int level) { Log::setLevel(level); }
+
+inline void setLogSink(LogSink sink) { Log::setSink(sink); }
+
+inline void logMessage(int level, const std::string& message) {
+
+	if (Log::enabled(level))
+		Log::write(level, message);
+}
+
+/**
+ * The resident memory of this process in MB, or 0 where this is not known.
+ */
+inline double
+residentMemoryMb() {
+
+#ifdef __linux__
+	std::ifstream statm("/proc/self/statm");
+	std::size_t size, resident;
+	if (statm >> size >> resident)
+		return resident*(double)sysconf(_SC_PAGESIZE)/(1024*1024);
+#endif
+
+	return 0;
+}
+
+/**
+ * Wall-clock time and resident memory after a stage of processing.
+ */
+struct StageTiming {
+
+	std::string stage;
+	double      seconds;
+	double      residentMb;
+};
+
+/**
+ * Times consecutive stages, and records them as StageTimings.
+ */
+class StageTimer {
+
+public:
+
+	StageTimer(std::vector<StageTiming>& timings) :
+		_timings(timings),
+		_start(std::chrono::steady_clock::now()) {}
+
+	/**
+	 * Finish the current stage with the given name, and start the next one.
+	 * Returns the seconds spent in the stage.
+	 */
+	double lap(const std::string& stage) {
+
+		auto now = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(now - _start).count();
+		_start = now;
+
+		double residentMb = residentMemoryMb();
+		_timings.push_back({stage, seconds, residentMb});
+
+		WATERZ_LOG_INFO(stage << ": " << seconds << "s, " << residentMb << "MB resident");
+
+		return seconds;
+	}
+
+	/**
+	 * Start the next stage without recording the current one.
+	 */
+	void skip() {
+
+		_start = std::chrono::steady_clock::now();
+	}
+
+private:
+
+	std::vector<StageTiming>& _timings;
+	std::chrono::steady_clock::time_point _start;
+};
+
+#endif // WATERZ_TELEMETRY_H__
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <algorithm>
+#include <stdexcept>
 #include "StatisticsProvider.hpp"
 
 /**
@@ -17,7 +18,11 @@ public:
 	typedef Precision ValueType;
 	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
 
-	VectorQuantileProvider(RegionGraphType& regionGraph) :
+	/**
+	 * Create a provider for the given quantile, which defaults to Q.
+	 */
+	VectorQuantileProvider(RegionGraphType& regionGraph, int q = Q) :
+		_q(q),
 		_values(regionGraph) {}
 
 	inline void addAffinity(EdgeIdType e, ValueType affinity) {
@@ -36,15 +41,27 @@ public:
 		_values[e].push_back(affinity);
 	}
 
+	inline void addAffinities(EdgeIdType e, ValueType affinity, std::size_t count) {
+
+		// initial edges keep only their highest affinity
+		if (InitWithMax) {
+
+			addAffinity(e, affinity);
+			return;
+		}
+
+		_values[e].insert(_values[e].end(), count, affinity);
+	}
+
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
 
 		_values[to].reserve(_values[to].size() + _values[from].size());
 
-		auto otherQuantile = getQuantileIterator(_values[from].begin(), _values[from].end(), Q);
+		auto otherQuantile = getQuantileIterator(_values[from].begin(), _values[from].end(), _q);
 		_values[to].insert(_values[to].begin(), _values[from].begin(), otherQuantile);
 		_values[to].insert(_values[to].end(), otherQuantile, _values[from].end());
 
-		auto quantile = getQuantileIterator(_values[to].begin(), _values[to].end(), Q);
+		auto quantile = getQuantileIterator(_values[to].begin(), _values[to].end(), _q);
 		std::nth_element(_values[to].begin(), quantile, _values[to].end());
 
 		_values[from].clear();
@@ -54,21 +71,33 @@ public:
 
 	inline ValueType operator[](EdgeIdType e) const {
 
-		auto quantile = getQuantileIterator(_values[e].begin(), _values[e].end(), Q);
+		auto quantile = getQuantileIterator(_values[e].begin(), _values[e].end(), _q);
 		return *quantile;
 	}
 
+	inline std::size_t memoryUsage() const {
+
+		return _values.memoryUsage();
+	}
+
+	inline void save(BinaryWriter& out) const {
+
+		_values.save(out);
+	}
+
+	inline void load(BinaryReader& in) {
+
+		_values.load(in);
+	}
+
 private:
 
 	template <typename It>
 	inline It getQuantileIterator(It begin, It end, int q) const {
 
 		size_t size = end - begin;
-		if (size == 0) {
-
-			std::cerr << "quantile provider is empty" << std::endl;
-			throw std::exception();
-		}
+		if (size == 0)
+			throw std::runtime_error("quantile provider is empty");
 
 		int pivot = q*size/100;
 		if (pivot == size)
@@ -77,6 +106,8 @@ private:
 		return begin + pivot;
 	}
 
+	int _q;
+
 	typename RegionGraphType::template EdgeMap<std::vector<Precision>> _values;
 };
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "types.hpp"
+#include "Telemetry.hpp"
+#include "MemoryUsage.hpp"
+#include "Progress.hpp"
 
 #include <iostream>
 
@@ -19,6 +22,13 @@
  * @param counts [out]
  *              A reference to a counts_t data structure that will be used to 
  *              store the sizes of the found regions.
+ * @param memory [out]
+ *              If given, records the peak of the buffer for the search of 
+ *              regions ("watershed_buffer").
+ * @param progress [in]
+ *              If given, reports the voxels processed in the first and the 
+ *              last (labelling) pass, and checks for cancellation, in which 
+ *              case Cancelled is thrown.
  */
 template<typename AG, typename V>
 inline
@@ -28,7 +38,9 @@ watershed(
         typename AG::element low,
         typename AG::element high,
         V& seg,
-        counts_t<std::size_t>& counts)
+        counts_t<std::size_t>& counts,
+        MemoryAccounting* memory = NULL,
+        ProgressReporter* progress = NULL)
 {
     typedef typename AG::element F;
     typedef typename V::element  ID;
@@ -52,6 +64,12 @@ watershed(
 
     for ( std::ptrdiff_t z = 0; z < zdim; ++z )
         for ( std::ptrdiff_t y = 0; y < ydim; ++y )
+        {
+            if ( progress )
+            {
+                progress->check((z*ydim + y)*xdim, size);
+            }
+
             for ( std::ptrdiff_t x = 0; x < xdim; ++x )
             {
                 ID& id = seg[z][y][x] = 0;
@@ -75,6 +93,7 @@ watershed(
                     if ( posx == m || posx >= high ) { id |= 0x20; }
                 }
             }
+        }
 
 
     //                              -z          -y     -x  +z         +y    +x
@@ -142,6 +161,11 @@ watershed(
 
     for ( std::ptrdiff_t idx = 0; idx < size; ++idx )
     {
+        if ( progress )
+        {
+            progress->check(idx, size);
+        }
+
         if ( seg_raw[idx] == 0 )
         {
             seg_raw[idx] |= traits::high_bit;
@@ -200,7 +224,13 @@ watershed(
         }
     }
 
-    std::cout << "found: " << (next_id-1) << " components\n";
+    WATERZ_LOG_INFO("found: " << (next_id-1) << " components");
+
+    // the buffer is cleared, but not shrunk, after each region
+    if ( memory )
+    {
+        memory->recordTransient("watershed_buffer", allocatedBytes(bfs));
+    }
 
     for ( std::ptrdiff_t idx = 0; idx < size; ++idx )
     {
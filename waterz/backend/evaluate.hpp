@@ -3,94 +3,94 @@
 
 #include <iostream>
 #include <tuple>
-#include <map>
+#include <vector>
+#include <algorithm>
+#include <thread>
 #include <math.h> 
 
+#include "ContingencyTable.hpp"
+#include "Telemetry.hpp"
+
 using namespace std;
 
-template <typename V1, typename V2>
+/**
+ * Compute Rand and VOI split and merge from a contingency table of 
+ * co-occurrences of ground-truth labels (i) and segmentation labels (j).
+ */
+inline
 std::tuple<double,double,double,double>
-compare_volumes(
-				 const V1& gt,
-				 const V2& ws){
+contingency_metrics(const ContingencyTable& p_ij) {
 
-	size_t dimX = gt.shape()[0];
-	size_t dimY = gt.shape()[1];
-	size_t dimZ = gt.shape()[2];
+	std::vector<ContingencyTable::Entry> entries = p_ij.entries();
 
 	double total = 0;
 
-	// number of co-occurences of label i and j
-	std::map<uint64_t, std::map<uint64_t, double>> p_ij;
+	// sum of squares in p_ij
+	double sum_p_ij = 0;
+	for ( auto& e: entries )
+	{
+		double n = e.count;
+		total += n;
+		sum_p_ij += n * n;
+	}
 
 	// number of occurences of label i and j in the respective volumes
-	std::map<uint64_t, double> s_i, t_j;
-
-	for ( std::ptrdiff_t z = 0; z < dimZ; ++z )
-		for ( std::ptrdiff_t y = 0; y < dimY; ++y )
-			for ( std::ptrdiff_t x = 0; x < dimX; ++x )
-			{
-				uint64_t wsv = ws[x][y][z];
-				uint64_t gtv = gt[x][y][z];
-
-				if ( gtv )
-				{
-					++total;
-
-					++p_ij[gtv][wsv];
-					++s_i[wsv];
-					++t_j[gtv];
-				}
-			}
+	std::vector<double> s_i, t_j;
 
-	// sum of squares in p_ij
-	double sum_p_ij = 0;
-	for ( auto& a: p_ij )
-		for ( auto& b: a.second )
-			sum_p_ij += b.second * b.second;
+	std::sort(entries.begin(), entries.end(),
+			[](const ContingencyTable::Entry& a, const ContingencyTable::Entry& b) { return a.i < b.i; });
+	for ( std::size_t k = 0; k < entries.size(); ++k )
+	{
+		if ( k == 0 || entries[k].i != entries[k-1].i )
+			t_j.push_back(0);
+		t_j.back() += entries[k].count;
+	}
+
+	std::sort(entries.begin(), entries.end(),
+			[](const ContingencyTable::Entry& a, const ContingencyTable::Entry& b) { return a.j < b.j; });
+	for ( std::size_t k = 0; k < entries.size(); ++k )
+	{
+		if ( k == 0 || entries[k].j != entries[k-1].j )
+			s_i.push_back(0);
+		s_i.back() += entries[k].count;
+	}
 
 	// sum of squares in t_j
 	double sum_t_k = 0;
-	for ( auto& a: t_j )
-		sum_t_k += a.second * a.second;
+	for ( double a: t_j )
+		sum_t_k += a * a;
 
 	// sum of squares in s_i
 	double sum_s_k = 0;
-	for ( auto& a: s_i )
-		sum_s_k += a.second * a.second;
-
-	// we have everything we need for RAND, normalize histograms for VOI
+	for ( double a: s_i )
+		sum_s_k += a * a;
 
-	for ( auto& a: p_ij )
-		for ( auto& b: a.second )
-			b.second /= total;
-
-	for ( auto& a: t_j )
-		a.second /= total;
-
-	for ( auto& a: s_i )
-		a.second /= total;
-
-	// compute entropies
+	// we have everything we need for RAND, compute entropies for VOI from the 
+	// normalized histograms
 
 	// H(s,t)
 	double H_st = 0;
-	for ( auto& a: p_ij )
-		for ( auto& b: a.second )
-			if(b.second)
-				H_st -= b.second * log2(b.second);
+	for ( auto& e: entries )
+	{
+		double p = e.count / total;
+		H_st -= p * log2(p);
+	}
 
 	// H(t)
 	double H_t = 0;
-	for ( auto& a: t_j )
-		if(a.second)
-			H_t -= a.second * log2(a.second);
+	for ( double a: t_j )
+	{
+		double p = a / total;
+		H_t -= p * log2(p);
+	}
 
 	// H(s)
 	double H_s = 0;
-	for ( auto& a: s_i )
-		if(a.second)
-			H_s -= a.second * log2(a.second);
+	for ( double a: s_i )
+	{
+		double p = a / total;
+		H_s -= p * log2(p);
+	}
 
 	double rand_split = sum_p_ij/sum_t_k;
 	double rand_merge = sum_p_ij/sum_s_k;
@@ -100,10 +100,10 @@ compare_volumes(
 	// H(t|s)
 	double voi_merge = H_st - H_s;
 
-	std::cout << "\tRand split: " << rand_split << "\n";
-	std::cout << "\tRand merge: " << rand_merge << "\n";
-	std::cout << "\tVOI split: " << voi_split << "\n";
-	std::cout << "\tVOI merge: " << voi_merge << "\n";
+	WATERZ_LOG_DEBUG("Rand split: " << rand_split);
+	WATERZ_LOG_DEBUG("Rand merge: " << rand_merge);
+	WATERZ_LOG_DEBUG("VOI split: " << voi_split);
+	WATERZ_LOG_DEBUG("VOI merge: " << voi_merge);
 
 	return std::make_tuple(
 			rand_split,
@@ -112,5 +112,147 @@ compare_volumes(
 			voi_merge);
 }
 
+/**
+ * Split numItems work items into consecutive ranges, one per thread, and call 
+ * f(table, begin, end) for each of them with a thread-local contingency table. 
+ * The thread-local tables are reduced into p_ij afterwards.
+ *
+ * @param numThreads [in]
+ *              The number of threads to use. If 0, one thread per hardware 
+ *              thread is used.
+ *
+ * @param maxThreads [in]
+ *              Upper bound on the number of threads, to avoid threads for 
+ *              too little work.
+ */
+template <typename F>
+void
+parallel_contingency(
+		ContingencyTable& p_ij,
+		std::size_t numItems,
+		int numThreads,
+		std::size_t maxThreads,
+		F f) {
+
+	if (numThreads <= 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = std::max(std::size_t(1), std::min(std::min(std::size_t(numThreads), maxThreads), numItems));
+
+	std::vector<ContingencyTable> local(numThreads - 1);
+
+	std::vector<std::thread> threads;
+	for ( int t = 1; t < numThreads; ++t )
+	{
+		std::size_t begin = numItems*t/numThreads;
+		std::size_t end = numItems*(t+1)/numThreads;
+
+		threads.emplace_back([&f, &local, t, begin, end]() {
+			f(local[t-1], begin, end);
+		});
+	}
+
+	f(p_ij, 0, numItems/numThreads);
+
+	for ( int t = 1; t < numThreads; ++t )
+	{
+		threads[t-1].join();
+		p_ij.add(local[t-1]);
+	}
+}
+
+// don't bother with threads for less than this number of voxels each
+const std::size_t MinVoxelsPerThread = 1 << 20;
+
+/**
+ * Add the co-occurrences of labels in two arrays of the given size to a 
+ * contingency table, ignoring pairs with label 0 in the first array. The arrays 
+ * are split into chunks of consecutive elements, one per thread, see 
+ * parallel_contingency().
+ */
+template <typename I, typename J>
+void
+accumulate_contingency(
+		ContingencyTable& p_ij,
+		const I* is,
+		const J* js,
+		std::size_t size,
+		int numThreads = 1) {
+
+	parallel_contingency(
+			p_ij, size, numThreads, size/MinVoxelsPerThread,
+			[is, js](ContingencyTable& table, std::size_t begin, std::size_t end) {
+				table.addArrays(is + begin, js + begin, end - begin);
+			});
+}
+
+/**
+ * Same as above for two 3D arrays of the given shape, accessed with the given 
+ * strides (in elements). Contiguous arrays are processed as flat arrays, all 
+ * others row by row without copying them.
+ */
+template <typename I, typename J>
+void
+accumulate_contingency(
+		ContingencyTable& p_ij,
+		const I* is,
+		const std::ptrdiff_t* isStrides,
+		const J* js,
+		const std::ptrdiff_t* jsStrides,
+		const std::size_t* shape,
+		int numThreads = 1) {
+
+	std::size_t size = shape[0]*shape[1]*shape[2];
+	if (size == 0)
+		return;
+
+	auto contiguous = [shape](const std::ptrdiff_t* strides) {
+		return
+				(shape[2] == 1 || strides[2] == 1) &&
+				(shape[1] == 1 || strides[1] == std::ptrdiff_t(shape[2])) &&
+				(shape[0] == 1 || strides[0] == std::ptrdiff_t(shape[1]*shape[2]));
+	};
+
+	if (contiguous(isStrides) && contiguous(jsStrides)) {
+
+		accumulate_contingency(p_ij, is, js, size, numThreads);
+		return;
+	}
+
+	std::size_t numRows = shape[0]*shape[1];
+
+	parallel_contingency(
+			p_ij, numRows, numThreads, size/MinVoxelsPerThread,
+			[=](ContingencyTable& table, std::size_t begin, std::size_t end) {
+				for (std::size_t row = begin; row < end; row++) {
+					std::ptrdiff_t z = row/shape[1];
+					std::ptrdiff_t y = row%shape[1];
+					table.addArrays(
+							is + z*isStrides[0] + y*isStrides[1],
+							js + z*jsStrides[0] + y*jsStrides[1],
+							shape[2],
+							isStrides[2],
+							jsStrides[2]);
+				}
+			});
+}
+
+/**
+ * Compare a segmentation against ground-truth, see accumulate_contingency() 
+ * for the use of threads.
+ */
+template <typename V1, typename V2>
+std::tuple<double,double,double,double>
+compare_volumes(
+				 const V1& gt,
+				 const V2& ws,
+				 int numThreads = 1){
+
+	// number of co-occurences of label i and j, ignoring background in gt
+	ContingencyTable p_ij;
+	accumulate_contingency(p_ij, gt.data(), ws.data(), gt.num_elements(), numThreads);
+
+	return contingency_metrics(p_ij);
+}
+
 #endif // WATERZ_EVALUATE_H__
 
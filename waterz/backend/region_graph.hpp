@@ -1,6 +1,9 @@
 #pragma once
 
 #include "types.hpp"
+#include "Telemetry.hpp"
+#include "MemoryUsage.hpp"
+#include "Progress.hpp"
 
 #include <cstddef>
 #include <iostream>
@@ -20,6 +23,18 @@
  *              A statistics provider to update on-the-fly.
  * @param region_graph [out]
  *              A reference to a region graph to store the result.
+ * @param affinity_scale [in]
+ *              Factor to convert the values of the affinity graph into the 
+ *              affinities passed to the statistics provider. Use this for 
+ *              quantized affinities (e.g., 1/255 for uint8, which maps each 
+ *              quantization level onto its own bin in a 256 bin histogram).
+ * @param memory [out]
+ *              If given, records the peak of the buffer of affinities per 
+ *              pair of regions ("region_graph_buffer"), and the memory of 
+ *              the region graph and statistics provider.
+ * @param progress [in]
+ *              If given, reports the sections processed and checks for 
+ *              cancellation, in which case Cancelled is thrown.
  */
 template<typename AG, typename V, typename StatisticsProviderType>
 inline
@@ -29,7 +44,10 @@ get_region_graph(
 		const V& seg,
 		std::size_t max_segid,
 		StatisticsProviderType& statisticsProvider,
-		RegionGraph<typename V::element>& rg) {
+		RegionGraph<typename V::element>& rg,
+		float affinity_scale = 1.0,
+		MemoryAccounting* memory = NULL,
+		ProgressReporter* progress = NULL) {
 
 	typedef typename AG::element F;
 	typedef typename V::element ID;
@@ -46,7 +64,11 @@ get_region_graph(
 	EdgeIdType e;
 	std::size_t p[3];
 	for (p[0] = 0; p[0] < zdim; ++p[0])
-		for (p[1] = 0; p[1] < ydim; ++p[1])
+		for (p[1] = 0; p[1] < ydim; ++p[1]) {
+
+			if (progress)
+				progress->check(p[0], zdim);
+
 			for (p[2] = 0; p[2] < xdim; ++p[2]) {
 
 				ID id1 = seg[p[0]][p[1]][p[2]];
@@ -66,6 +88,9 @@ get_region_graph(
 					}
 				}
 			}
+		}
+
+	std::size_t bufferBytes = (memory ? allocatedBytes(affinities) : 0);
 
 	for (ID id1 = 1; id1 <= max_segid; ++id1) {
 		for (const auto& p: affinities[id1]) {
@@ -76,9 +101,39 @@ get_region_graph(
 			statisticsProvider.notifyNewEdge(e);
 
 			for (F affinity : p.second)
-				statisticsProvider.addAffinity(e, affinity);
+				statisticsProvider.addAffinity(e, affinity*affinity_scale);
         }
     }
 
-	std::cout << "Region graph number of edges: " << rg.edges().size() << std::endl;
+	WATERZ_LOG_INFO("Region graph number of edges: " << rg.edges().size());
+
+	if (memory) {
+
+		// the buffer is freed only after the region graph was created
+		memory->record("region_graph", rg.memoryUsage());
+		memory->record("statistics_provider", statisticsProvider.memoryUsage());
+		memory->recordTransient("region_graph_buffer", bufferBytes);
+	}
+}
+
+/**
+ * Estimate the peak bytes of the buffer of get_region_graph(), for fragments 
+ * with the given number of edges between them and voxel faces (i.e., 
+ * affinities) on those edges.
+ */
+template <typename F, typename ID>
+std::size_t
+estimate_region_graph_buffer(
+		std::size_t num_fragments,
+		std::size_t num_edges,
+		std::size_t num_faces) {
+
+	std::size_t faces_per_edge = (num_edges == 0 ? 0 : (num_faces + num_edges - 1)/num_edges);
+
+	return
+			(num_fragments + 1)*sizeof(std::map<ID, std::vector<F>>) +
+			num_edges*(
+					4*sizeof(void*) +
+					sizeof(std::pair<const ID, std::vector<F>>) +
+					grownCapacity(faces_per_edge)*sizeof(F));
 }
@@ -0,0 +1,116 @@
+'''
+Compiler flags for the agglomeration modules.
+
+This file is read by setup.py (without importing waterz) to build the prebuilt
+modules with the default profile, and used by _get_module() in
+waterz/__init__.py for modules compiled on first use.
+'''
+
+import os
+
+# portable, such that prebuilt modules run on any machine
+DEFAULT_PROFILE = {
+    'opt_level': 3,
+    'march': 'portable',
+    'lto': False,
+    'pgo': False,
+}
+
+def parse_profile(description):
+    '''
+    Create a profile from a comma separated list of options, as used for the
+    environment variable WATERZ_BUILD_PROFILE, e.g., 'native,lto,pgo' or
+    'O2,portable'. Options that are not given keep their default.
+    '''
+
+    profile = dict(DEFAULT_PROFILE)
+
+    for option in description.split(','):
+
+        option = option.strip()
+        if option == '':
+            continue
+        elif option in ['O0', 'O1', 'O2', 'O3']:
+            profile['opt_level'] = int(option[1])
+        elif option in ['native', 'portable']:
+            profile['march'] = option
+        elif option in ['lto', 'pgo']:
+            profile[option] = True
+        elif option in ['no-lto', 'no-pgo']:
+            profile[option[3:]] = False
+        else:
+            raise ValueError("unknown build profile option '%s'"%option)
+
+    return profile
+
+def check_profile(profile):
+
+    assert set(profile.keys()) == set(DEFAULT_PROFILE.keys()), (
+        "build profile needs the keys %s"%sorted(DEFAULT_PROFILE.keys()))
+    assert profile['opt_level'] in [0, 1, 2, 3], (
+        "opt_level has to be 0, 1, 2, or 3")
+    assert profile['march'] in ['native', 'portable'], (
+        "march has to be 'native' or 'portable'")
+
+def compile_args(profile):
+
+    args = ['-std=c++11', '-w', '-pthread', '-O%d'%profile['opt_level']]
+    if profile['march'] == 'native':
+        # without fused multiply-adds, scores and thus merges are the same as
+        # with 'portable'
+        args += ['-march=native', '-ffp-contract=off']
+    if profile['lto']:
+        args.append('-flto')
+
+    return args
+
+def link_args(profile):
+
+    args = ['-std=c++11', '-pthread']
+    if profile['lto']:
+        args += ['-flto', '-O%d'%profile['opt_level']]
+
+    return args
+
+def cpu_id():
+    '''
+    Identify the CPU of this machine, such that modules compiled with
+    -march=native are not shared between different CPUs (e.g., via a home
+    directory on a cluster).
+    '''
+
+    import hashlib
+    import platform
+
+    description = platform.machine() + platform.processor()
+
+    try:
+        with open('/proc/cpuinfo', 'r') as f:
+            for line in f:
+                if line.startswith('model name') or line.startswith('flags'):
+                    description += line
+                if line.strip() == '':
+                    # first processor is enough
+                    break
+    except OSError:
+        pass
+
+    return hashlib.md5(description.encode('utf-8')).hexdigest()
+
+def cache_key(profile):
+    '''
+    The part of the module key that depends on the build profile.
+    '''
+
+    key = tuple(sorted(profile.items()))
+    if profile['march'] == 'native':
+        key += (cpu_id(),)
+
+    return key
+
+def get_default_profile():
+    '''
+    The profile given by WATERZ_BUILD_PROFILE, or DEFAULT_PROFILE if not set.
+    '''
+
+    return parse_profile(os.environ.get('WATERZ_BUILD_PROFILE', ''))
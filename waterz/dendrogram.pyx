@@ -0,0 +1,99 @@
+from libc.stdint cimport uint32_t, uint64_t
+import numpy as np
+cimport numpy as np
+
+np.import_array()
+
+ctypedef fused seg_id_type:
+    uint32_t
+    uint64_t
+
+def cut_dendrogram(dendrogram, threshold, num_labels=None):
+    '''
+    Cut a dendrogram at the given threshold, i.e., apply all merges with a
+    score lower than the threshold.
+
+    This gives the same segmentation as agglomerate() for this threshold, but
+    does not need to repeat the agglomeration, and runs in time linear in the
+    number of fragments.
+
+    Parameters
+    ----------
+
+        dendrogram: numpy structured array
+
+            The dendrogram as returned by agglomerate_dendrogram(), with fields
+            'child', 'parent', and 'score'.
+
+        threshold: float
+
+            The threshold to cut the dendrogram at.
+
+        num_labels: int (optional)
+
+            The size of the returned label map, has to be larger than the
+            largest fragment ID. If not given, the largest ID in the dendrogram
+            plus one is used.
+
+    Returns
+    -------
+
+        A numpy array labels, mapping each fragment ID to a segment ID. The
+        segmentation is obtained with ``labels[fragments]``.
+    '''
+
+    assert dendrogram.dtype.names == ('child', 'parent', 'score'), (
+        "dendrogram has to be a structured array with fields 'child', "
+        "'parent', and 'score'")
+
+    dendrogram = np.ascontiguousarray(dendrogram)
+    seg_dtype = dendrogram.dtype['child']
+
+    max_id = 0
+    if len(dendrogram) > 0:
+        max_id = max(dendrogram['child'].max(), dendrogram['parent'].max())
+
+    if num_labels is None:
+        num_labels = max_id + 1
+    assert num_labels > max_id, (
+        "num_labels has to be larger than the largest ID in the dendrogram")
+
+    labels = np.empty((num_labels,), dtype=seg_dtype)
+    __cut(dendrogram, threshold, labels)
+
+    return labels
+
+def __cut(
+        np.ndarray dendrogram,
+        float threshold,
+        np.ndarray[seg_id_type, ndim=1] labels):
+
+    assert dendrogram.itemsize == sizeof(DendrogramMerge[seg_id_type, float])
+
+    cdef const DendrogramMerge[seg_id_type, float]* merges = \
+        <const DendrogramMerge[seg_id_type, float]*>np.PyArray_DATA(dendrogram)
+    cdef size_t num_merges = dendrogram.shape[0]
+    cdef seg_id_type* labels_data = <seg_id_type*>np.PyArray_DATA(labels)
+    cdef size_t num_labels = labels.shape[0]
+
+    with nogil:
+        cutDendrogram[seg_id_type, float](
+            merges,
+            num_merges,
+            threshold,
+            labels_data,
+            num_labels)
+
+cdef extern from "backend/Dendrogram.hpp" nogil:
+
+    cdef cppclass DendrogramMerge[N, S]:
+        N child
+        N parent
+        S score
+
+    void cutDendrogram[N, S](
+            const DendrogramMerge[N, S]* merges,
+            size_t                       numMerges,
+            S                            threshold,
+            N*                           labels,
+            size_t                       numLabels)
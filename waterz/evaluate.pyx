@@ -1,39 +1,239 @@
-from libc.stdint cimport uint64_t
+from libc.stddef cimport ptrdiff_t
+from libc.stdint cimport uint32_t, uint64_t
 import numpy as np
 cimport numpy as np
 
-def evaluate(
-        np.ndarray[uint64_t, ndim=3] segmentation,
-        np.ndarray[uint64_t, ndim=3] gt):
+np.import_array()
+
+ctypedef fused segmentation_type:
+    uint32_t
+    uint64_t
+
+ctypedef fused gt_type:
+    uint32_t
+    uint64_t
+
+def evaluate(segmentation, gt, num_threads=0):
+    '''
+    Compute Rand and VOI split and merge of a segmentation, compared to a
+    ground-truth. Voxels with ground-truth label 0 are ignored.
+
+    Both arrays are read as they are (without copies), if they are of type
+    uint32 or uint64, in any combination and with any memory layout. Arrays
+    of other types are converted to uint64 first.
+
+    Parameters
+    ----------
+
+        num_threads: int, default 0
+
+            The number of threads to use. If 0, one thread per core is used.
+    '''
+
+    segmentation = _label_volume(segmentation)
+    gt = _label_volume(gt)
 
     for d in range(3):
         assert segmentation.shape[d] == gt.shape[d], (
             "Shapes in dim %d do not match"%d)
-    shape = segmentation.shape
 
-    # the C++ part assumes contiguous memory, make sure we have it (and do 
-    # nothing, if we do)
-    if not segmentation.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous segmentation arrray (avoid this by passing C_CONTIGUOUS arrays)")
+    return __compare_arrays(segmentation, gt, num_threads)
+
+def __compare_arrays(
+        np.ndarray[segmentation_type, ndim=3] segmentation,
+        np.ndarray[gt_type, ndim=3] gt,
+        int num_threads):
+
+    cdef ptrdiff_t segmentation_strides[3]
+    cdef ptrdiff_t gt_strides[3]
+
+    if not _element_strides(segmentation, segmentation_strides):
         segmentation = np.ascontiguousarray(segmentation)
-    if gt is not None and not gt.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        _element_strides(segmentation, segmentation_strides)
+    if not _element_strides(gt, gt_strides):
         gt = np.ascontiguousarray(gt)
+        _element_strides(gt, gt_strides)
 
-    cdef uint64_t* segmentation_data
-    cdef uint64_t* gt_data
-
-    segmentation_data = &segmentation[0, 0, 0]
-    gt_data = &gt[0, 0, 0]
+    cdef segmentation_type* segmentation_data = <segmentation_type*>np.PyArray_DATA(segmentation)
+    cdef gt_type*           gt_data = <gt_type*>np.PyArray_DATA(gt)
+    cdef size_t             width = segmentation.shape[0]
+    cdef size_t             height = segmentation.shape[1]
+    cdef size_t             depth = segmentation.shape[2]
+    cdef Metrics            scores
 
-    scores = compare_arrays(
-        shape[0], shape[1], shape[2],
-        gt_data,
-        segmentation_data)
+    with nogil:
+        scores = compare_arrays[gt_type, segmentation_type](
+            width, height, depth,
+            gt_data, gt_strides,
+            segmentation_data, segmentation_strides,
+            num_threads)
 
     return scores
 
-cdef extern from "frontend_evaluate.h":
+def _label_volume(array):
+    '''
+    Get a 3D uint32 or uint64 view of the given labels. Only arrays of other
+    types and with more than three dimensions are copied.
+    '''
+
+    array = np.asarray(array)
+
+    if array.dtype != np.uint32 and array.dtype != np.uint64:
+        array = array.astype(np.uint64)
+
+    if array.ndim < 3:
+        array = array.reshape((1,)*(3 - array.ndim) + array.shape)
+    elif array.ndim > 3:
+        array = array.reshape((-1,) + array.shape[-2:])
+
+    return array
+
+cdef bint _element_strides(np.ndarray array, ptrdiff_t* strides):
+    '''
+    Get the strides of a 3D array in elements. Returns False, if the strides
+    are not a multiple of the element size.
+    '''
+
+    for d in range(3):
+        if array.strides[d] % array.itemsize != 0:
+            return False
+        strides[d] = array.strides[d] // array.itemsize
+
+    return True
+
+cdef class StreamingEvaluation:
+    '''
+    Compute Rand and VOI split and merge of a segmentation, compared to a
+    ground-truth, chunk by chunk. Use this for volumes that do not fit into
+    memory: Only the contingency table of ground-truth and segmentation labels
+    is kept between calls to ``add``, which is independent of the volume size.
+
+    Chunks can have any shape, but have to be disjoint and cover the volume of
+    interest. The result does not depend on the order or shape of the chunks.
+
+    Parameters
+    ----------
+
+        num_threads: int, default 0
+
+            The number of threads to use per chunk. If 0, one thread per core
+            is used.
+    '''
+
+    cdef CStreamingEvaluation* evaluation
+
+    def __cinit__(self, num_threads=0):
+        self.evaluation = new CStreamingEvaluation(num_threads)
+
+    def __dealloc__(self):
+        del self.evaluation
+
+    def add(self, segmentation, gt):
+        '''
+        Add a chunk of segmentation and corresponding ground-truth. As for
+        ``evaluate``, uint32 and uint64 chunks are read without copies.
+        '''
+
+        assert segmentation.shape == gt.shape, "Shapes of chunks do not match"
+
+        self._add(_label_volume(segmentation), _label_volume(gt))
+
+    def _add(
+            self,
+            np.ndarray[segmentation_type, ndim=3] segmentation,
+            np.ndarray[gt_type, ndim=3] gt):
+
+        cdef ptrdiff_t segmentation_strides[3]
+        cdef ptrdiff_t gt_strides[3]
+
+        if not _element_strides(segmentation, segmentation_strides):
+            segmentation = np.ascontiguousarray(segmentation)
+            _element_strides(segmentation, segmentation_strides)
+        if not _element_strides(gt, gt_strides):
+            gt = np.ascontiguousarray(gt)
+            _element_strides(gt, gt_strides)
+
+        cdef segmentation_type* segmentation_data = <segmentation_type*>np.PyArray_DATA(segmentation)
+        cdef gt_type*           gt_data = <gt_type*>np.PyArray_DATA(gt)
+        cdef size_t             width = segmentation.shape[0]
+        cdef size_t             height = segmentation.shape[1]
+        cdef size_t             depth = segmentation.shape[2]
+
+        with nogil:
+            self.evaluation.add[gt_type, segmentation_type](
+                width, height, depth,
+                gt_data, gt_strides,
+                segmentation_data, segmentation_strides)
+
+    def metrics(self):
+        '''
+        Get the scores over all chunks added so far.
+        '''
+
+        cdef Metrics scores
+
+        with nogil:
+            scores = self.evaluation.metrics()
+
+        return scores
+
+def evaluate_chunked(segmentation, gt, chunk_size=64, num_threads=0):
+    '''
+    Compute Rand and VOI split and merge of a segmentation, compared to a
+    ground-truth, reading the volumes in slabs of ``chunk_size`` sections along
+    the first axis.
+
+    Use this with memory-mapped arrays (``numpy.memmap``, ``numpy.load(...,
+    mmap_mode='r')``) or any other array-like that can be sliced along the
+    first axis, like HDF5 or zarr datasets, to evaluate volumes that do not
+    fit into memory.
+    '''
+
+    assert segmentation.shape == gt.shape, "Shapes do not match"
+
+    evaluation = StreamingEvaluation(num_threads)
+
+    for z in range(0, segmentation.shape[0], chunk_size):
+        evaluation.add(
+            np.asarray(segmentation[z:z + chunk_size]),
+            np.asarray(gt[z:z + chunk_size]))
+
+    return evaluation.metrics()
+
+# the Python callable log messages are passed to, see set_log_level()
+_log_callback = None
+
+cdef void __log_to_callback(int level, const char* message) noexcept with gil:
+
+    try:
+        _log_callback(level, message.decode('utf-8', 'replace'))
+    except Exception:
+        pass
+
+def set_log_level(level, callback=None):
+    '''
+    Set the log level and callback of this module, see
+    waterz.set_log_level().
+    '''
+
+    global _log_callback
+
+    _log_callback = callback
+    setLogLevel(level)
+    if callback is None:
+        setLogSink(NULL)
+    else:
+        setLogSink(__log_to_callback)
+
+cdef extern from "backend/Telemetry.hpp" nogil:
+
+    ctypedef void (*LogSink)(int level, const char* message) noexcept
+
+    void setLogLevel(int level)
+
+    void setLogSink(LogSink sink)
+
+cdef extern from "frontend_evaluate.h" nogil:
 
     struct Metrics:
         double voi_split
@@ -41,9 +241,24 @@ cdef extern from "frontend_evaluate.h":
         double rand_split
         double rand_merge
 
-    Metrics compare_arrays(
-            size_t          width,
-            size_t          height,
-            size_t          depth,
-            const uint64_t* gt_data,
-            const uint64_t* segmentation_data);
+    Metrics compare_arrays[G, S](
+            size_t           width,
+            size_t           height,
+            size_t           depth,
+            const G*         gt_data,
+            const ptrdiff_t* gt_strides,
+            const S*         segmentation_data,
+            const ptrdiff_t* segmentation_strides,
+            int              num_threads) except +
+
+    cdef cppclass CStreamingEvaluation "StreamingEvaluation":
+        CStreamingEvaluation(int num_threads)
+        void add[G, S](
+                size_t           width,
+                size_t           height,
+                size_t           depth,
+                const G*         gt_data,
+                const ptrdiff_t* gt_strides,
+                const S*         segmentation_data,
+                const ptrdiff_t* segmentation_strides) except +
+        Metrics metrics()
@@ -3,32 +3,152 @@
 #include <iostream>
 #include <algorithm>
 #include <vector>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <cstdio>
+#include <typeinfo>
 
 #include "frontend_agglomerate.h"
-#include "evaluate.hpp"
 #include "backend/MergeFunctions.hpp"
 #include "backend/basic_watershed.hpp"
 #include "backend/region_graph.hpp"
 
 std::map<int, WaterzContext*> WaterzContext::_contexts;
 int WaterzContext::_nextId = 0;
+std::mutex WaterzContext::_contextsMutex;
 
+/**
+ * Convert the affinity thresholds for the initial watershed into the value 
+ * range of quantized affinities, such that comparing the quantized values 
+ * gives the same result as comparing the scaled values.
+ */
+template <typename T>
+std::pair<T, T>
+quantizeThresholds(
+		AffValue affThresholdLow,
+		AffValue affThresholdHigh,
+		AffValue affinityScale) {
+
+	double max = std::numeric_limits<T>::max();
+
+	// watershed tests 'affinity > low' and 'affinity >= high'
+	double low  = std::floor(affThresholdLow/affinityScale);
+	double high = std::ceil(affThresholdHigh/affinityScale);
+
+	return std::make_pair(
+			(T)std::min(std::max(low, 0.0), max),
+			(T)std::min(std::max(high, 0.0), max));
+}
+
+/**
+ * Configure the statistics provider of a scoring function given at runtime 
+ * (see DynamicScoringFunction).
+ */
+template <typename ProviderType>
+static auto
+configureStatisticsProvider(
+		ProviderType&      provider,
+		const std::string& scoringExpression,
+		int) -> decltype(provider.setExpression(scoringExpression), void()) {
+
+	provider.setExpression(scoringExpression);
+}
+
+/**
+ * Compiled scoring functions can not be configured.
+ */
+template <typename ProviderType>
+static void
+configureStatisticsProvider(
+		ProviderType&,
+		const std::string& scoringExpression,
+		long) {
+
+	if (!scoringExpression.empty())
+		throw std::invalid_argument(
+				"a scoring function was given, but this module was compiled for "
+				"a fixed one");
+}
+
+/**
+ * The expression of a scoring function given at runtime.
+ */
+template <typename ProviderType>
+static auto
+getScoringExpression(const ProviderType& provider, int) -> decltype(provider.getExpression()) {
+
+	return provider.getExpression();
+}
+
+/**
+ * Compiled scoring functions have no expression.
+ */
+template <typename ProviderType>
+static std::string
+getScoringExpression(const ProviderType&, long) {
+
+	return "";
+}
+
+std::shared_ptr<StatisticsProviderType>
+createStatisticsProvider(
+		RegionGraphType&   regionGraph,
+		const std::string& scoringExpression) {
+
+	std::shared_ptr<StatisticsProviderType> statisticsProvider(
+			new StatisticsProviderType(regionGraph)
+	);
+	configureStatisticsProvider(*statisticsProvider, scoringExpression, 0);
+
+	return statisticsProvider;
+}
+
+/**
+ * Check the scoring function before the expensive parts of initialization.
+ */
+static void
+checkScoringExpression(const std::string& scoringExpression) {
+
+	RegionGraphType regionGraph;
+	createStatisticsProvider(regionGraph, scoringExpression);
+}
+
+/**
+ * Record the bytes of the components that persist between calls.
+ */
+static void
+recordMemoryUsage(WaterzContext& context) {
+
+	context.memory.record("fragment_sizes", context.segmentCounter->memoryUsage());
+	context.memory.record("region_graph", context.regionGraph->memoryUsage());
+	context.memory.record("statistics_provider", context.statisticsProvider->memoryUsage());
+	context.memory.record("region_merging", context.regionMerging->memoryUsage());
+	context.memory.record("edge_queue", context.regionMerging->queueMemoryUsage());
+}
+
+template <typename AffinityType>
 WaterzState
-initialize(
-		std::size_t     width,
-		std::size_t     height,
-		std::size_t     depth,
-		const AffValue* affinity_data,
-		SegID*          segmentation_data,
-		const GtID*     ground_truth_data,
-		AffValue        affThresholdLow,
-		AffValue        affThresholdHigh,
-		bool            findFragments) {
+initializeFromAffinities(
+		std::size_t         width,
+		std::size_t         height,
+		std::size_t         depth,
+		const AffinityType* affinity_data,
+		SegID*              segmentation_data,
+		const GtID*         ground_truth_data,
+		AffinityType        affThresholdLow,
+		AffinityType        affThresholdHigh,
+		AffValue            affinityScale,
+		bool                findFragments,
+		const std::string&  scoringExpression,
+		ProgressReporter*   progress) {
+
+	checkScoringExpression(scoringExpression);
 
 	std::size_t num_voxels = width*height*depth;
 
 	// wrap affinities (no copy)
-	affinity_graph_ref<AffValue> affinities(
+	affinity_graph_ref<AffinityType> affinities(
 			affinity_data,
 			boost::extents[3][width][height][depth]
 	);
@@ -43,42 +163,59 @@ initialize(
 
 	counts_t<std::size_t> sizes;
 
+	std::vector<StageTiming> stageTimings;
+	StageTimer timer(stageTimings);
+	MemoryAccounting memory;
+
 	if (findFragments) {
 
-		std::cout << "performing initial watershed segmentation..." << std::endl;
+		WATERZ_LOG_INFO("performing initial watershed segmentation...");
 
-		watershed(affinities, affThresholdLow, affThresholdHigh, *segmentation, sizes);
+		if (progress)
+			progress->start("watershed");
+
+		watershed(affinities, affThresholdLow, affThresholdHigh, *segmentation, sizes, &memory, progress);
+		timer.lap("watershed");
 
 	} else {
 
-		std::cout << "counting regions and sizes..." << std::endl;
+		WATERZ_LOG_INFO("counting regions and sizes...");
 
 		std::size_t maxId = *std::max_element(segmentation_data, segmentation_data + num_voxels);
 		sizes.resize(maxId + 1);
 		for (std::size_t i = 0; i < num_voxels; i++)
 			sizes[segmentation_data[i]]++;
+		timer.lap("count_sizes");
 	}
 
+	memory.record("fragment_sizes", allocatedBytes(sizes));
+
 	std::size_t numNodes = sizes.size();
-	std::cout << "creating region graph for " << numNodes << " nodes" << std::endl;
+	WATERZ_LOG_INFO("creating region graph for " << numNodes << " nodes");
 
 	std::shared_ptr<RegionGraphType> regionGraph(
 			new RegionGraphType(numNodes)
 	);
 
-	std::cout << "creating statistics provider" << std::endl;
-	std::shared_ptr<StatisticsProviderType> statisticsProvider(
-			new StatisticsProviderType(*regionGraph)
-	);
+	WATERZ_LOG_DEBUG("creating statistics provider");
+	std::shared_ptr<StatisticsProviderType> statisticsProvider =
+			createStatisticsProvider(*regionGraph, scoringExpression);
+
+	WATERZ_LOG_INFO("extracting region graph...");
 
-	std::cout << "extracting region graph..." << std::endl;
+	if (progress)
+		progress->start("region_graph");
 
 	get_region_graph(
 			affinities,
 			*segmentation,
 			numNodes - 1,
 			*statisticsProvider,
-			*regionGraph);
+			*regionGraph,
+			affinityScale,
+			&memory,
+			progress);
+	timer.lap("region_graph");
 
 	std::shared_ptr<ScoringFunctionType> scoringFunction(
 			new ScoringFunctionType(*regionGraph, *statisticsProvider)
@@ -94,66 +231,465 @@ initialize(
 	context->scoringFunction    = scoringFunction;
 	context->statisticsProvider = statisticsProvider;
 	context->segmentation       = segmentation;
+	context->segmentCounter     = std::make_shared<SegmentCounter>(std::move(sizes));
+	context->memory             = std::move(memory);
+	recordMemoryUsage(*context);
 
 	WaterzState initial_state;
 	initial_state.context = context->id;
 
 	if (ground_truth_data != NULL) {
 
+		WATERZ_LOG_INFO("computing overlap of fragments with ground-truth");
+
 		// wrap ground-truth (no copy)
-		volume_const_ref_ptr<GtID> groundtruth(
-				new volume_const_ref<GtID>(
-						ground_truth_data,
-						boost::extents[width][height][depth]
-				)
+		volume_const_ref<GtID> groundtruth(
+				ground_truth_data,
+				boost::extents[width][height][depth]
 		);
 
-		context->groundtruth = groundtruth;
+		context->evaluation = std::make_shared<IncrementalEvaluationType>(
+				groundtruth,
+				*segmentation,
+				numNodes);
+		timer.lap("groundtruth_overlap");
+	}
+
+	context->stageTimings = std::move(stageTimings);
+
+	return initial_state;
+}
+
+WaterzState
+initialize(
+		std::size_t        width,
+		std::size_t        height,
+		std::size_t        depth,
+		const AffValue*    affinity_data,
+		SegID*             segmentation_data,
+		const GtID*        ground_truth_data,
+		AffValue           affThresholdLow,
+		AffValue           affThresholdHigh,
+		bool               findFragments,
+		const std::string& scoringExpression,
+		ProgressReporter*  progress) {
+
+	return initializeFromAffinities(
+			width, height, depth,
+			affinity_data,
+			segmentation_data,
+			ground_truth_data,
+			affThresholdLow,
+			affThresholdHigh,
+			1.0,
+			findFragments,
+			scoringExpression,
+			progress);
+}
+
+WaterzState
+initialize(
+		std::size_t              width,
+		std::size_t              height,
+		std::size_t              depth,
+		const QuantizedAffValue* affinity_data,
+		SegID*                   segmentation_data,
+		const GtID*              ground_truth_data,
+		AffValue                 affThresholdLow,
+		AffValue                 affThresholdHigh,
+		AffValue                 affinityScale,
+		bool                     findFragments,
+		const std::string&       scoringExpression,
+		ProgressReporter*        progress) {
+
+	auto thresholds = quantizeThresholds<QuantizedAffValue>(
+			affThresholdLow,
+			affThresholdHigh,
+			affinityScale);
+
+	return initializeFromAffinities(
+			width, height, depth,
+			affinity_data,
+			segmentation_data,
+			ground_truth_data,
+			thresholds.first,
+			thresholds.second,
+			affinityScale,
+			findFragments,
+			scoringExpression,
+			progress);
+}
+
+WaterzState
+initializeFromRegionGraph(
+		std::size_t        numNodes,
+		std::size_t        numEdges,
+		const SegID*       u,
+		const SegID*       v,
+		const AffValue*    affinities,
+		const uint64_t*    contactAreas,
+		const uint64_t*    nodeSizes,
+		const std::string& scoringExpression,
+		ProgressReporter*  progress) {
+
+	std::vector<StageTiming> stageTimings;
+	StageTimer timer(stageTimings);
+
+	WATERZ_LOG_INFO("creating region graph for " << numNodes << " nodes");
+
+	std::shared_ptr<RegionGraphType> regionGraph(
+			new RegionGraphType(numNodes)
+	);
+
+	WATERZ_LOG_DEBUG("creating statistics provider");
+	std::shared_ptr<StatisticsProviderType> statisticsProvider =
+			createStatisticsProvider(*regionGraph, scoringExpression);
+
+	std::vector<std::size_t> sizes(numNodes, 0);
+	for (SegID n = 1; n < numNodes; n++) {
+
+		sizes[n] = (nodeSizes ? nodeSizes[n] : 1);
+		statisticsProvider->addVoxels(n, sizes[n]);
+	}
+
+	WATERZ_LOG_INFO("adding " << numEdges << " edges...");
+
+	if (progress)
+		progress->start("region_graph");
+
+	for (std::size_t i = 0; i < numEdges; i++) {
+
+		if (progress)
+			progress->check(i, numEdges);
+
+		if (u[i] >= numNodes || v[i] >= numNodes)
+			throw std::invalid_argument("node ID of edge exceeds number of nodes");
+
+		if (u[i] == 0 || v[i] == 0 || u[i] == v[i])
+			continue;
+
+		auto mm = std::minmax(u[i], v[i]);
+
+		RegionGraphType::EdgeIdType e = regionGraph->findEdge(mm.first, mm.second);
+		if (e == RegionGraphType::NoEdge) {
+
+			e = regionGraph->addEdge(mm.first, mm.second);
+			statisticsProvider->notifyNewEdge(e);
+		}
+
+		statisticsProvider->addAffinities(
+				e,
+				affinities[i],
+				(contactAreas ? contactAreas[i] : 1));
 	}
 
+	WATERZ_LOG_INFO("Region graph number of edges: " << regionGraph->edges().size());
+	timer.lap("region_graph");
+
+	std::shared_ptr<ScoringFunctionType> scoringFunction(
+			new ScoringFunctionType(*regionGraph, *statisticsProvider)
+	);
+
+	std::shared_ptr<RegionMergingType> regionMerging(
+			new RegionMergingType(*regionGraph)
+	);
+
+	WaterzContext* context = WaterzContext::createNew();
+	context->regionGraph        = regionGraph;
+	context->regionMerging      = regionMerging;
+	context->scoringFunction    = scoringFunction;
+	context->statisticsProvider = statisticsProvider;
+	context->segmentCounter     = std::make_shared<SegmentCounter>(std::move(sizes));
+	context->stageTimings       = std::move(stageTimings);
+	recordMemoryUsage(*context);
+
+	WaterzState initial_state;
+	initial_state.context = context->id;
+
 	return initial_state;
 }
 
 std::vector<Merge>
 mergeUntil(
-		WaterzState& state,
-		float        threshold) {
+		WaterzState&      state,
+		float             threshold,
+		std::size_t       targetNumSegments,
+		std::size_t       maxSegmentSize,
+		ProgressReporter* progress) {
 
 	WaterzContext* context = WaterzContext::get(state.context);
 
-	std::cout << "merging until threshold " << threshold << std::endl;
+	// without a callback, the reporter only checks for cancellation
+	ProgressReporter noProgress;
+	ProgressReporter& reporter = (progress ? *progress : noProgress);
+
+	WATERZ_LOG_INFO("merging until threshold " << threshold);
+
+	MergeStatistics& statistics = context->statistics;
+	statistics = MergeStatistics();
 
 	std::vector<Merge>  mergeHistory;
-	MergeHistoryVisitor mergeHistoryVisitor(mergeHistory);
+	MergeHistoryVisitor mergeHistoryVisitor(mergeHistory, context->evaluation.get());
+	StoppingVisitor<MergeHistoryVisitor> stoppingVisitor(
+			mergeHistoryVisitor,
+			*context->segmentCounter,
+			targetNumSegments,
+			maxSegmentSize);
+	StatisticsVisitor<StoppingVisitor<MergeHistoryVisitor>> statisticsVisitor(
+			stoppingVisitor,
+			*context->regionGraph,
+			statistics);
+	ProgressVisitor<StatisticsVisitor<StoppingVisitor<MergeHistoryVisitor>>> visitor(
+			statisticsVisitor,
+			reporter,
+			*context->regionMerging);
 
-	std::size_t merged = context->regionMerging->mergeUntil(
-			*context->scoringFunction,
-			*context->statisticsProvider,
-			threshold,
-			mergeHistoryVisitor);
+	StageTimer timer(context->stageTimings);
+
+	// scoring is not interrupted, as it has to be completed in one go, and 
+	// only happens in the first call
+	reporter.start("scoring");
+	if (context->regionMerging->scoreEdges(*context->scoringFunction)) {
+
+		statistics.scoringSeconds = timer.lap("scoring");
+		recordMemoryUsage(*context);
+		if (progress)
+			progress->report(0, 0, 0, context->regionMerging->queueSize());
+	}
+
+	std::size_t merged = 0;
+	if (!reporter.cancelled()) {
+
+		reporter.start("merging");
+		merged = context->regionMerging->mergeUntil(
+				*context->scoringFunction,
+				*context->statisticsProvider,
+				threshold,
+				visitor);
+		statistics.mergingSeconds = timer.lap("merging");
+		recordMemoryUsage(*context);
+		if (progress)
+			visitor.report();
+	}
 
-	if (merged) {
+	if (reporter.cancelled())
+		WATERZ_LOG_INFO("merging cancelled after " << merged << " merges");
 
-		std::cout << "extracting segmentation" << std::endl;
+	if (merged && context->segmentation) {
+
+		WATERZ_LOG_DEBUG("extracting segmentation");
 
 		context->regionMerging->extractSegmentation(*context->segmentation);
+		statistics.extractionSeconds = timer.lap("extraction");
 	}
 
-	if (context->groundtruth) {
+	if (context->evaluation) {
 
-		std::cout << "evaluating current segmentation against ground-truth" << std::endl;
+		WATERZ_LOG_DEBUG("evaluating current segmentation against ground-truth");
 
-		auto m = compare_volumes(*context->groundtruth, *context->segmentation);
+		auto m = context->evaluation->metrics();
 
 		state.metrics.rand_split = std::get<0>(m);
 		state.metrics.rand_merge = std::get<1>(m);
 		state.metrics.voi_split  = std::get<2>(m);
 		state.metrics.voi_merge  = std::get<3>(m);
+
+		WATERZ_LOG_INFO(
+				"Rand split: " << state.metrics.rand_split <<
+				", Rand merge: " << state.metrics.rand_merge <<
+				", VOI split: " << state.metrics.voi_split <<
+				", VOI merge: " << state.metrics.voi_merge);
+
+		statistics.evaluationSeconds = timer.lap("evaluation");
 	}
 
 	return mergeHistory;
 }
 
+MergeStatistics
+getMergeStatistics(WaterzState& state) {
+
+	return WaterzContext::get(state.context)->statistics;
+}
+
+std::vector<StageTiming>
+getStageTimings(WaterzState& state) {
+
+	WaterzContext* context = WaterzContext::get(state.context);
+
+	std::vector<StageTiming> stageTimings;
+	std::swap(stageTimings, context->stageTimings);
+
+	return stageTimings;
+}
+
+std::vector<ComponentMemory>
+getMemoryUsage(WaterzState& state) {
+
+	WaterzContext* context = WaterzContext::get(state.context);
+
+	std::vector<ComponentMemory> components = context->memory.components();
+	components.push_back({
+			"total",
+			context->memory.totalBytes(),
+			context->memory.peakTotalBytes()});
+
+	return components;
+}
+
+std::vector<ComponentMemory>
+estimateMemoryUsage(
+		std::size_t        width,
+		std::size_t        height,
+		std::size_t        depth,
+		std::size_t        numFragments,
+		bool               quantizedAffinities,
+		bool               findFragments,
+		const std::string& scoringExpression) {
+
+	if (numFragments == 0)
+		throw std::invalid_argument("can not estimate memory without fragments");
+
+	std::size_t numVoxels = width*height*depth;
+	numFragments = std::min(numFragments, numVoxels);
+	std::size_t numNodes = numFragments + 1;
+
+	// Fragments are approximated as cubes of their mean size, with 3 faces 
+	// per voxel on their surface to their neighbors. Watershed fragments have 
+	// up to 10 neighbors on average (i.e., 5 edges per fragment), fewer the 
+	// larger they are.
+	double meanSize = (double)numVoxels/numFragments;
+	std::size_t numFaces = std::min<double>(3.0*numVoxels, 3.0*numVoxels/std::cbrt(meanSize));
+	std::size_t numEdges = std::min<std::size_t>(numFaces, 5*numFragments);
+	std::size_t facesPerEdge = (numEdges == 0 ? 0 : (numFaces + numEdges - 1)/numEdges);
+
+	// the bytes of the statistics provider per node, edge, and affinity, 
+	// measured on a region graph with a single node and edge
+	RegionGraphType probe(1);
+	std::shared_ptr<StatisticsProviderType> provider =
+			createStatisticsProvider(probe, scoringExpression);
+	std::size_t nodeBytes = provider->memoryUsage();
+	RegionGraphType::EdgeIdType e = probe.addEdge(0, 0);
+	provider->notifyNewEdge(e);
+	std::size_t edgeBytes = provider->memoryUsage() - nodeBytes;
+	provider->addAffinity(e, (AffValue)0.5);
+	std::size_t affinityBytes = provider->memoryUsage() - nodeBytes - edgeBytes;
+
+	std::vector<ComponentMemory> components;
+	auto add = [&components](const std::string& component, std::size_t bytes) {
+		components.push_back({component, bytes, bytes});
+		return bytes;
+	};
+
+	// the search for regions can visit a large part of the volume at once, 
+	// assume the worst case
+	std::size_t watershedBuffer = 0;
+	if (findFragments)
+		watershedBuffer = add(
+				"watershed_buffer",
+				grownCapacity(numVoxels)*sizeof(std::ptrdiff_t));
+
+	std::size_t fragmentSizes = add(
+			"fragment_sizes",
+			(findFragments ? grownCapacity(numNodes) : numNodes)*sizeof(std::size_t));
+
+	std::size_t regionGraphBuffer = add(
+			"region_graph_buffer",
+			quantizedAffinities ?
+					estimate_region_graph_buffer<QuantizedAffValue, SegID>(numFragments, numEdges, numFaces) :
+					estimate_region_graph_buffer<AffValue, SegID>(numFragments, numEdges, numFaces));
+
+	std::size_t regionGraph = add(
+			"region_graph",
+			RegionGraphType::estimateMemoryUsage(numNodes, numEdges));
+
+	std::size_t statisticsProvider = add(
+			"statistics_provider",
+			numNodes*nodeBytes +
+			grownCapacity(numEdges)*edgeBytes +
+			numEdges*grownCapacity(facesPerEdge)*affinityBytes);
+
+	std::size_t regionMerging = add(
+			"region_merging",
+			RegionMergingType::estimateMemoryUsage(numNodes, numEdges));
+
+	std::size_t edgeQueue = add(
+			"edge_queue",
+			RegionMergingType::estimateQueueMemoryUsage(numEdges));
+
+	// peak of watershed, region graph extraction, and merging
+	std::size_t merging = fragmentSizes + regionGraph + statisticsProvider + regionMerging + edgeQueue;
+	std::size_t peak = std::max({
+			fragmentSizes + watershedBuffer,
+			fragmentSizes + regionGraphBuffer + regionGraph + statisticsProvider,
+			merging});
+
+	components.push_back({"total", merging, peak});
+
+	return components;
+}
+
+std::vector<CurvePoint>
+getMetricsCurve(
+		WaterzState&                   state,
+		const std::vector<ScoreValue>& thresholds,
+		bool                           everyMerge) {
+
+	WaterzContext* context = WaterzContext::get(state.context);
+
+	if (!context->evaluation)
+		throw std::invalid_argument("metrics curve requested without ground-truth");
+
+	std::vector<ScoreValue> sorted(thresholds);
+	std::sort(sorted.begin(), sorted.end());
+
+	std::vector<CurvePoint> curve;
+	MetricsCurveVisitor metricsCurveVisitor(
+			*context->evaluation,
+			(everyMerge ? &curve : NULL));
+	StoppingVisitor<MetricsCurveVisitor> visitor(
+			metricsCurveVisitor,
+			*context->segmentCounter);
+
+	for (ScoreValue threshold : sorted) {
+
+		WATERZ_LOG_INFO("merging until threshold " << threshold);
+
+		context->regionMerging->mergeUntil(
+				*context->scoringFunction,
+				*context->statisticsProvider,
+				threshold,
+				visitor);
+
+		if (!everyMerge)
+			curve.push_back(CurvePoint(threshold, context->evaluation->metrics()));
+	}
+
+	return curve;
+}
+
+std::vector<DendrogramEntry>
+getDendrogram(WaterzState& state) {
+
+	WaterzContext* context = WaterzContext::get(state.context);
+
+	std::vector<DendrogramEntry> dendrogram;
+	DendrogramVisitor dendrogramVisitor(dendrogram);
+	StoppingVisitor<DendrogramVisitor> visitor(
+			dendrogramVisitor,
+			*context->segmentCounter);
+
+	WATERZ_LOG_INFO("merging until all regions are merged");
+
+	context->regionMerging->mergeUntil(
+			*context->scoringFunction,
+			*context->statisticsProvider,
+			std::numeric_limits<ScoreValue>::infinity(),
+			visitor);
+
+	return dendrogram;
+}
+
 std::vector<ScoredEdge>
 getRegionGraph(WaterzState& state) {
 
@@ -164,8 +700,423 @@ getRegionGraph(WaterzState& state) {
 	return regionMerging->extractRegionGraph<ScoredEdge>(*scoringFunction);
 }
 
+static const std::string CheckpointMagic = "waterz checkpoint";
+static const uint32_t CheckpointVersion = 3;
+
+/**
+ * Identifies the types a checkpoint depends on, i.e., the scoring function 
+ * (and thus the statistics provider), the queue, and the segment ID type.
+ */
+static std::string
+checkpointTypes() {
+
+	return
+			std::string(typeid(RegionMergingType).name()) + " " +
+			std::string(typeid(ScoringFunctionType).name()) + " " +
+			std::string(typeid(StatisticsProviderType).name());
+}
+
+/**
+ * Read and validate the header of a checkpoint.
+ */
+static CheckpointInfo
+readCheckpointHeader(BinaryReader& in) {
+
+	std::string magic;
+	uint32_t version;
+	std::string types;
+
+	in.read(magic);
+	if (magic != CheckpointMagic)
+		throw std::runtime_error("not a waterz checkpoint");
+
+	in.read(version);
+	if (version != CheckpointVersion)
+		throw std::runtime_error("unsupported checkpoint version");
+
+	in.read(types);
+	if (types != checkpointTypes())
+		throw std::runtime_error(
+				"checkpoint was created with a different scoring function, "
+				"queue, or segment ID type");
+
+	uint64_t width, height, depth;
+	uint8_t hasGroundTruth;
+	in.read(width);
+	in.read(height);
+	in.read(depth);
+	in.read(hasGroundTruth);
+
+	CheckpointInfo info;
+	info.width = width;
+	info.height = height;
+	info.depth = depth;
+	info.hasGroundTruth = hasGroundTruth;
+	in.read(info.scoringExpression);
+
+	uint64_t targetNumSegments, maxSegmentSize;
+	in.read(info.arguments.thresholds);
+	in.read(info.arguments.affThresholdLow);
+	in.read(info.arguments.affThresholdHigh);
+	in.read(info.arguments.affinityScale);
+	in.read(targetNumSegments);
+	in.read(maxSegmentSize);
+	in.read(info.arguments.inputDigest);
+	info.arguments.targetNumSegments = targetNumSegments;
+	info.arguments.maxSegmentSize = maxSegmentSize;
+
+	return info;
+}
+
+/**
+ * Throw if a checkpoint was not created for the expected volume and arguments.
+ */
+static void
+checkCheckpointInfo(
+		const std::string&    filename,
+		const CheckpointInfo& info,
+		const CheckpointInfo& expected) {
+
+	std::string mismatch;
+
+	if (info.width != expected.width || info.height != expected.height || info.depth != expected.depth)
+		mismatch = "volume shape";
+	else if (info.hasGroundTruth != expected.hasGroundTruth)
+		mismatch = "ground-truth";
+	else if (info.scoringExpression != expected.scoringExpression)
+		mismatch = "scoring function";
+	else if (info.arguments.thresholds != expected.arguments.thresholds)
+		mismatch = "thresholds";
+	else if (
+			info.arguments.affThresholdLow != expected.arguments.affThresholdLow ||
+			info.arguments.affThresholdHigh != expected.arguments.affThresholdHigh ||
+			info.arguments.affinityScale != expected.arguments.affinityScale)
+		mismatch = "affinity thresholds or scale";
+	else if (
+			info.arguments.targetNumSegments != expected.arguments.targetNumSegments ||
+			info.arguments.maxSegmentSize != expected.arguments.maxSegmentSize)
+		mismatch = "stopping criteria";
+	else if (info.arguments.inputDigest != expected.arguments.inputDigest)
+		mismatch = "input volumes";
+
+	if (!mismatch.empty())
+		throw std::invalid_argument(
+				"checkpoint " + filename + " was created for different " + mismatch +
+				", remove it to start over");
+}
+
+void
+saveCheckpoint(
+		WaterzState&               state,
+		const std::string&         filename,
+		const CheckpointArguments& arguments) {
+
+	WaterzContext* context = WaterzContext::get(state.context);
+
+	WATERZ_LOG_INFO("saving checkpoint to " << filename);
+
+	std::string tmpFilename = filename + ".tmp";
+
+	{
+		BinaryWriter out(tmpFilename);
+
+		// states created from a region graph have no segmentation, store it 
+		// with size 0
+		const volume_ref_ptr<SegID>& segmentation = context->segmentation;
+
+		out.write(CheckpointMagic);
+		out.write(CheckpointVersion);
+		out.write(checkpointTypes());
+		for (int d = 0; d < 3; d++)
+			out.write(uint64_t(segmentation ? segmentation->shape()[d] : 0));
+		out.write(uint8_t(context->evaluation ? 1 : 0));
+		out.write(getScoringExpression(*context->statisticsProvider, 0));
+		out.write(arguments.thresholds);
+		out.write(arguments.affThresholdLow);
+		out.write(arguments.affThresholdHigh);
+		out.write(arguments.affinityScale);
+		out.write(uint64_t(arguments.targetNumSegments));
+		out.write(uint64_t(arguments.maxSegmentSize));
+		out.write(arguments.inputDigest);
+
+		out.write(state.metrics);
+		if (segmentation)
+			out.write(segmentation->data(), segmentation->num_elements()*sizeof(SegID));
+
+		context->regionGraph->save(out);
+		context->statisticsProvider->save(out);
+		context->regionMerging->save(out);
+		context->segmentCounter->save(out);
+		if (context->evaluation)
+			context->evaluation->save(out);
+
+		out.close();
+	}
+
+#ifdef _WIN32
+	// rename does not replace existing files on Windows
+	std::remove(filename.c_str());
+#endif
+
+	if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+		throw std::runtime_error("can not rename " + tmpFilename + " to " + filename);
+}
+
+CheckpointInfo
+getCheckpointInfo(const std::string& filename) {
+
+	BinaryReader in(filename);
+
+	return readCheckpointHeader(in);
+}
+
+WaterzState
+loadCheckpoint(
+		const std::string&    filename,
+		SegID*                segmentation_data,
+		const CheckpointInfo* expected) {
+
+	WATERZ_LOG_INFO("loading checkpoint from " << filename);
+
+	BinaryReader in(filename);
+
+	CheckpointInfo info = readCheckpointHeader(in);
+	if (expected)
+		checkCheckpointInfo(filename, info, *expected);
+
+	WaterzState state;
+	in.read(state.metrics);
+
+	volume_ref_ptr<SegID> segmentation;
+	if (info.width*info.height*info.depth > 0) {
+
+		segmentation.reset(
+				new volume_ref<SegID>(
+						segmentation_data,
+						boost::extents[info.width][info.height][info.depth]
+				)
+		);
+		in.read(segmentation_data, segmentation->num_elements()*sizeof(SegID));
+	}
+
+	// create all parts first, such that they register their node and edge maps 
+	// with the region graph, then restore them
+	std::shared_ptr<RegionGraphType> regionGraph(new RegionGraphType());
+	std::shared_ptr<StatisticsProviderType> statisticsProvider(
+			new StatisticsProviderType(*regionGraph)
+	);
+	std::shared_ptr<ScoringFunctionType> scoringFunction(
+			new ScoringFunctionType(*regionGraph, *statisticsProvider)
+	);
+	std::shared_ptr<RegionMergingType> regionMerging(
+			new RegionMergingType(*regionGraph)
+	);
+	std::shared_ptr<SegmentCounter> segmentCounter(new SegmentCounter());
+	std::shared_ptr<IncrementalEvaluationType> evaluation;
+	if (info.hasGroundTruth)
+		evaluation = std::make_shared<IncrementalEvaluationType>();
+
+	regionGraph->load(in);
+	statisticsProvider->load(in);
+	regionMerging->load(in);
+	segmentCounter->load(in);
+	if (evaluation)
+		evaluation->load(in);
+
+	WaterzContext* context = WaterzContext::createNew();
+	context->regionGraph        = regionGraph;
+	context->regionMerging      = regionMerging;
+	context->scoringFunction    = scoringFunction;
+	context->statisticsProvider = statisticsProvider;
+	context->segmentation       = segmentation;
+	context->segmentCounter     = segmentCounter;
+	context->evaluation         = evaluation;
+	recordMemoryUsage(*context);
+
+	state.context = context->id;
+
+	return state;
+}
+
 void
 free(WaterzState& state) {
 
 	WaterzContext::free(state.context);
 }
+
+BatchAgglomeration::~BatchAgglomeration() {
+
+	// let workers finish their current job, but don't start new ones
+	_cancelled = true;
+
+	for (std::thread& worker : _workers)
+		worker.join();
+}
+
+void
+BatchAgglomeration::addJob(
+		std::size_t               width,
+		std::size_t               height,
+		std::size_t               depth,
+		const AffValue*           affinity_data,
+		const SegID*              fragments_data,
+		SegID*                    segmentations_data,
+		const std::vector<float>& thresholds,
+		AffValue                  affThresholdLow,
+		AffValue                  affThresholdHigh) {
+
+	Job job;
+	job.width                   = width;
+	job.height                  = height;
+	job.depth                   = depth;
+	job.affinity_data           = affinity_data;
+	job.quantized_affinity_data = NULL;
+	job.fragments_data          = fragments_data;
+	job.segmentations_data      = segmentations_data;
+	job.thresholds              = thresholds;
+	job.affThresholdLow         = affThresholdLow;
+	job.affThresholdHigh        = affThresholdHigh;
+	job.affinityScale           = 1.0;
+
+	_jobs.push_back(job);
+}
+
+void
+BatchAgglomeration::addJob(
+		std::size_t               width,
+		std::size_t               height,
+		std::size_t               depth,
+		const QuantizedAffValue*  affinity_data,
+		const SegID*              fragments_data,
+		SegID*                    segmentations_data,
+		const std::vector<float>& thresholds,
+		AffValue                  affThresholdLow,
+		AffValue                  affThresholdHigh,
+		AffValue                  affinityScale) {
+
+	Job job;
+	job.width                   = width;
+	job.height                  = height;
+	job.depth                   = depth;
+	job.affinity_data           = NULL;
+	job.quantized_affinity_data = affinity_data;
+	job.fragments_data          = fragments_data;
+	job.segmentations_data      = segmentations_data;
+	job.thresholds              = thresholds;
+	job.affThresholdLow         = affThresholdLow;
+	job.affThresholdHigh        = affThresholdHigh;
+	job.affinityScale           = affinityScale;
+
+	_jobs.push_back(job);
+}
+
+void
+BatchAgglomeration::start(int numThreads) {
+
+	if (numThreads <= 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = std::min(numThreads, (int)_jobs.size());
+
+	WATERZ_LOG_INFO("processing " << _jobs.size() << " jobs on " << numThreads << " threads");
+
+	for (int i = 0; i < numThreads; i++)
+		_workers.emplace_back(&BatchAgglomeration::work, this);
+}
+
+int
+BatchAgglomeration::next() {
+
+	std::unique_lock<std::mutex> lock(_finishedMutex);
+
+	if (_numCollected == _jobs.size())
+		return -1;
+
+	_jobFinished.wait(lock, [this]{ return _numFinished > _numCollected; });
+
+	return _finished[_numCollected++];
+}
+
+void
+BatchAgglomeration::work() {
+
+	// Jobs are independent, so workers simply grab the next unprocessed job 
+	// until all are taken. This balances blocks of different sizes the same 
+	// way work-stealing would, without per-thread queues.
+	while (!_cancelled) {
+
+		std::size_t i = _nextJob++;
+		if (i >= _jobs.size())
+			return;
+
+		try {
+
+			process(_jobs[i]);
+
+		} catch (std::exception& e) {
+
+			_jobs[i].error = std::string("agglomeration failed: ") + e.what();
+			WATERZ_LOG_ERROR("job " << i << ": " << _jobs[i].error);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_finishedMutex);
+			_finished.push_back(i);
+			_numFinished++;
+		}
+		_jobFinished.notify_one();
+	}
+}
+
+void
+BatchAgglomeration::process(Job& job) {
+
+	std::size_t numVoxels = job.width*job.height*job.depth;
+
+	// the working segmentation, merged in-place by mergeUntil()
+	std::vector<SegID> segmentation(numVoxels, 0);
+	if (job.fragments_data)
+		std::copy(job.fragments_data, job.fragments_data + numVoxels, segmentation.begin());
+
+	WaterzState state;
+	if (job.affinity_data)
+		state = initialize(
+				job.width, job.height, job.depth,
+				job.affinity_data,
+				&segmentation[0],
+				NULL,
+				job.affThresholdLow,
+				job.affThresholdHigh,
+				job.fragments_data == NULL,
+				_scoringExpression);
+	else
+		state = initialize(
+				job.width, job.height, job.depth,
+				job.quantized_affinity_data,
+				&segmentation[0],
+				NULL,
+				job.affThresholdLow,
+				job.affThresholdHigh,
+				job.affinityScale,
+				job.fragments_data == NULL,
+				_scoringExpression);
+
+	try {
+
+		for (std::size_t k = 0; k < job.thresholds.size(); k++) {
+
+			mergeUntil(state, job.thresholds[k]);
+
+			std::copy(
+					segmentation.begin(),
+					segmentation.end(),
+					job.segmentations_data + k*numVoxels);
+		}
+
+	} catch (...) {
+
+		free(state);
+		throw;
+	}
+
+	free(state);
+}
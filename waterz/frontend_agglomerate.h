@@ -2,6 +2,11 @@
 #define C_FRONTEND_H
 
 #include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include "backend/IterativeRegionMerging.hpp"
 #include "backend/MergeFunctions.hpp"
@@ -11,11 +16,20 @@
 #include "backend/PriorityQueue.hpp"
 #include "backend/HistogramQuantileProvider.hpp"
 #include "backend/VectorQuantileProvider.hpp"
-#include "evaluate.hpp"
+#include "backend/IncrementalEvaluation.hpp"
+#include "backend/Dendrogram.hpp"
+#include "backend/Serialization.hpp"
+#include "backend/DynamicScoringFunction.hpp"
+#include "backend/Telemetry.hpp"
+#include "backend/MemoryUsage.hpp"
+#include "backend/Progress.hpp"
+
+// to be created by __init__.py
+#include <SegID.h>
 
-typedef uint64_t SegID;
 typedef uint32_t GtID;
 typedef float AffValue;
+typedef uint8_t QuantizedAffValue;
 typedef float ScoreValue;
 typedef RegionGraph<SegID> RegionGraphType;
 
@@ -25,6 +39,8 @@ typedef RegionGraph<SegID> RegionGraphType;
 
 typedef typename ScoringFunctionType::StatisticsProviderType StatisticsProviderType;
 typedef IterativeRegionMerging<SegID, ScoreValue, QueueType> RegionMergingType;
+typedef IncrementalEvaluation<SegID> IncrementalEvaluationType;
+typedef DendrogramMerge<SegID, ScoreValue> DendrogramEntry;
 
 struct Metrics {
 
@@ -54,12 +70,153 @@ struct ScoredEdge {
 	ScoreValue score;
 };
 
+struct CurvePoint {
+
+	CurvePoint(ScoreValue threshold_, const std::tuple<double,double,double,double>& metrics) :
+		threshold(threshold_),
+		rand_split(std::get<0>(metrics)),
+		rand_merge(std::get<1>(metrics)),
+		voi_split(std::get<2>(metrics)),
+		voi_merge(std::get<3>(metrics)) {}
+
+	ScoreValue threshold;
+	double rand_split;
+	double rand_merge;
+	double voi_split;
+	double voi_merge;
+};
+
+/**
+ * Counters and timings of one call to mergeUntil(), see StatisticsVisitor.
+ */
+struct MergeStatistics {
+
+	// edges taken from the queue
+	std::size_t pops;
+
+	// popped edges that were deleted already (wasted pops)
+	std::size_t deletedPops;
+
+	// popped edges that were stale, and were rescored and pushed again
+	std::size_t stalePops;
+
+	std::size_t merges;
+
+	// mean and maximal increase of the score of stale edges by rescoring
+	double      meanScoreDelta;
+	double      maxScoreDelta;
+
+	// the maximal number of edges of a region created by a merge
+	std::size_t maxDegree;
+
+	// initial scoring of all edges (only in the first call), merging, 
+	// extraction of the segmentation, and evaluation
+	double      scoringSeconds;
+	double      mergingSeconds;
+	double      extractionSeconds;
+	double      evaluationSeconds;
+};
+
+/**
+ * The arguments an agglomeration was started with, stored in its checkpoints 
+ * to detect resuming with different ones.
+ */
+struct CheckpointArguments {
+
+	// all thresholds of the agglomeration, sorted
+	std::vector<float> thresholds;
+
+	AffValue    affThresholdLow;
+	AffValue    affThresholdHigh;
+	AffValue    affinityScale;
+	std::size_t targetNumSegments;
+	std::size_t maxSegmentSize;
+
+	// a digest of the input volumes, computed by the caller
+	std::string inputDigest;
+};
+
+struct CheckpointInfo {
+
+	std::size_t width;
+	std::size_t height;
+	std::size_t depth;
+	bool        hasGroundTruth;
+
+	// the scoring function, if given at runtime (see DynamicScoringFunction)
+	std::string scoringExpression;
+
+	CheckpointArguments arguments;
+};
+
 struct WaterzState {
 
 	int     context;
 	Metrics metrics;
 };
 
+/**
+ * Keeps track of the number of segments and the size of the largest segment 
+ * while merging.
+ */
+class SegmentCounter {
+
+public:
+
+	/**
+	 * Create from the sizes of the initial fragments, indexed by ID. ID 0 is 
+	 * background and not counted as a segment.
+	 */
+	SegmentCounter(std::vector<std::size_t> sizes = std::vector<std::size_t>()) :
+		_sizes(std::move(sizes)),
+		_numSegments(0),
+		_maxSegmentSize(0) {
+
+		for (std::size_t id = 1; id < _sizes.size(); id++) {
+
+			if (_sizes[id] == 0)
+				continue;
+
+			_numSegments++;
+			_maxSegmentSize = std::max(_maxSegmentSize, _sizes[id]);
+		}
+	}
+
+	void notifyMerge(SegID from, SegID to) {
+
+		_sizes[to] += _sizes[from];
+		_sizes[from] = 0;
+		_numSegments--;
+		_maxSegmentSize = std::max(_maxSegmentSize, _sizes[to]);
+	}
+
+	std::size_t numSegments() const { return _numSegments; }
+
+	std::size_t maxSegmentSize() const { return _maxSegmentSize; }
+
+	void save(BinaryWriter& out) const {
+
+		out.write(_sizes);
+		out.write(_numSegments);
+		out.write(_maxSegmentSize);
+	}
+
+	void load(BinaryReader& in) {
+
+		in.read(_sizes);
+		in.read(_numSegments);
+		in.read(_maxSegmentSize);
+	}
+
+	std::size_t memoryUsage() const { return allocatedBytes(_sizes); }
+
+private:
+
+	std::vector<std::size_t> _sizes;
+	std::size_t _numSegments;
+	std::size_t _maxSegmentSize;
+};
+
 class WaterzContext {
 
 public:
@@ -67,6 +224,9 @@ public:
 	static WaterzContext* createNew() {
 
 		WaterzContext* context = new WaterzContext();
+
+		std::lock_guard<std::mutex> lock(_contextsMutex);
+
 		context->id = _nextId;
 		_nextId++;
 		_contexts.insert(std::make_pair(context->id, context));
@@ -76,21 +236,32 @@ public:
 
 	static WaterzContext* get(int id) {
 
-		if (!_contexts.count(id))
+		std::lock_guard<std::mutex> lock(_contextsMutex);
+
+		auto it = _contexts.find(id);
+		if (it == _contexts.end())
 			return NULL;
 
-		return _contexts.at(id);
+		return it->second;
 	}
 
 	static void free(int id) {
 
-		WaterzContext* context = get(id);
+		WaterzContext* context = NULL;
 
-		if (context) {
+		{
+			std::lock_guard<std::mutex> lock(_contextsMutex);
 
-			_contexts.erase(id);
-			delete context;
+			auto it = _contexts.find(id);
+			if (it != _contexts.end()) {
+
+				context = it->second;
+				_contexts.erase(it);
+			}
 		}
+
+		// delete outside of the lock, this can take a while for large graphs
+		delete context;
 	}
 
 	int id;
@@ -100,7 +271,17 @@ public:
 	std::shared_ptr<ScoringFunctionType> scoringFunction;
 	std::shared_ptr<StatisticsProviderType> statisticsProvider;
 	volume_ref_ptr<SegID> segmentation;
-	volume_const_ref_ptr<GtID> groundtruth;
+	std::shared_ptr<IncrementalEvaluationType> evaluation;
+	std::shared_ptr<SegmentCounter> segmentCounter;
+
+	// statistics of the last call to mergeUntil()
+	MergeStatistics statistics = MergeStatistics();
+
+	// stages since the last call to getStageTimings()
+	std::vector<StageTiming> stageTimings;
+
+	// bytes of the region graph, statistics, queue, ... since initialization
+	MemoryAccounting memory;
 
 private:
 
@@ -108,8 +289,10 @@ private:
 
 	~WaterzContext() {}
 
+	// contexts are created and freed from concurrent Python threads
 	static std::map<int, WaterzContext*> _contexts;
 	static int _nextId;
+	static std::mutex _contextsMutex;
 };
 
 class RegionMergingVisitor {
@@ -123,41 +306,586 @@ public:
 	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {}
 
 	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {}
+
+	bool stop() { return false; }
+};
+
+/**
+ * Wraps another visitor, and stops merging once at most targetNumSegments 
+ * segments are left, or a segment of at least maxSegmentSize voxels was 
+ * created. A value of 0 disables the respective criterion.
+ */
+template <typename Visitor>
+class StoppingVisitor {
+
+public:
+
+	StoppingVisitor(
+			Visitor& visitor,
+			SegmentCounter& counter,
+			std::size_t targetNumSegments = 0,
+			std::size_t maxSegmentSize = 0) :
+		_visitor(visitor),
+		_counter(counter),
+		_targetNumSegments(targetNumSegments),
+		_maxSegmentSize(maxSegmentSize) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		_visitor.onPop(e, score);
+	}
+
+	void onDeletedEdgeFound(RegionGraphType::EdgeIdType e) {
+
+		_visitor.onDeletedEdgeFound(e);
+	}
+
+	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {
+
+		_visitor.onStaleEdgeFound(e, oldScore, newScore);
+	}
+
+	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_counter.notifyMerge((c == a ? b : a), c);
+		_visitor.onMerge(a, b, c, score);
+	}
+
+	bool stop() {
+
+		if (_targetNumSegments && _counter.numSegments() <= _targetNumSegments)
+			return true;
+
+		if (_maxSegmentSize && _counter.maxSegmentSize() >= _maxSegmentSize)
+			return true;
+
+		return _visitor.stop();
+	}
+
+private:
+
+	Visitor& _visitor;
+	SegmentCounter& _counter;
+	std::size_t _targetNumSegments;
+	std::size_t _maxSegmentSize;
+};
+
+/**
+ * Wraps another visitor, and counts the events of the merge loop in a 
+ * MergeStatistics.
+ */
+template <typename Visitor>
+class StatisticsVisitor {
+
+public:
+
+	StatisticsVisitor(
+			Visitor& visitor,
+			const RegionGraphType& regionGraph,
+			MergeStatistics& statistics) :
+		_visitor(visitor),
+		_regionGraph(regionGraph),
+		_statistics(statistics),
+		_sumScoreDelta(0) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		_statistics.pops++;
+		_visitor.onPop(e, score);
+	}
+
+	void onDeletedEdgeFound(RegionGraphType::EdgeIdType e) {
+
+		_statistics.deletedPops++;
+		_visitor.onDeletedEdgeFound(e);
+	}
+
+	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {
+
+		double delta = newScore - oldScore;
+
+		_statistics.stalePops++;
+		_sumScoreDelta += delta;
+		_statistics.meanScoreDelta = _sumScoreDelta/_statistics.stalePops;
+		_statistics.maxScoreDelta = std::max(_statistics.maxScoreDelta, delta);
+
+		_visitor.onStaleEdgeFound(e, oldScore, newScore);
+	}
+
+	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_statistics.merges++;
+		_statistics.maxDegree = std::max(_statistics.maxDegree, _regionGraph.incEdges(c).size());
+
+		_visitor.onMerge(a, b, c, score);
+	}
+
+	bool stop() {
+
+		return _visitor.stop();
+	}
+
+private:
+
+	Visitor& _visitor;
+	const RegionGraphType& _regionGraph;
+	MergeStatistics& _statistics;
+	double _sumScoreDelta;
+};
+
+/**
+ * Wraps another visitor, reports the merges done, the score of the last popped 
+ * edge, and the size of the queue to a ProgressReporter, and stops merging if 
+ * the reporter got cancelled.
+ */
+template <typename Visitor>
+class ProgressVisitor {
+
+public:
+
+	ProgressVisitor(
+			Visitor& visitor,
+			ProgressReporter& progress,
+			const RegionMergingType& regionMerging) :
+		_visitor(visitor),
+		_progress(progress),
+		_regionMerging(regionMerging),
+		_merges(0),
+		_minScore(0) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		_minScore = score;
+		_visitor.onPop(e, score);
+	}
+
+	void onDeletedEdgeFound(RegionGraphType::EdgeIdType e) {
+
+		_visitor.onDeletedEdgeFound(e);
+	}
+
+	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {
+
+		_visitor.onStaleEdgeFound(e, oldScore, newScore);
+	}
+
+	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_merges++;
+		_visitor.onMerge(a, b, c, score);
+	}
+
+	bool stop() {
+
+		if (_progress.due())
+			report();
+
+		if (_progress.cancelled())
+			return true;
+
+		return _visitor.stop();
+	}
+
+	/**
+	 * Report the current progress, regardless of the interval.
+	 */
+	void report() {
+
+		_progress.report(_merges, 0, _minScore, _regionMerging.queueSize());
+	}
+
+private:
+
+	Visitor& _visitor;
+	ProgressReporter& _progress;
+	const RegionMergingType& _regionMerging;
+	std::size_t _merges;
+	double _minScore;
 };
 
 class MergeHistoryVisitor : public RegionMergingVisitor {
 
 public:
 
-	MergeHistoryVisitor(std::vector<Merge>& history) : _history(history) {}
+	/**
+	 * Record merges in the given history. If evaluation is not NULL, it will 
+	 * be updated with each merge.
+	 */
+	MergeHistoryVisitor(
+			std::vector<Merge>& history,
+			IncrementalEvaluationType* evaluation = NULL) :
+		_history(history),
+		_evaluation(evaluation) {}
 
 	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
 
 		_history.push_back({a, b, c, score});
+
+		if (_evaluation)
+			_evaluation->notifyMerge((c == a ? b : a), c);
 	}
 
 private:
 
 	std::vector<Merge>& _history;
+	IncrementalEvaluationType* _evaluation;
 };
 
-WaterzState initialize(
-		size_t          width,
-		size_t          height,
-		size_t          depth,
-		const AffValue* affinity_data,
-		SegID*          segmentation_data,
-		const GtID*     groundtruth_data = NULL,
-		AffValue        affThresholdLow  = 0.0001,
-		AffValue        affThresholdHigh = 0.9999,
-		bool            findFragments = true);
+/**
+ * Updates an incremental evaluation with each merge, and optionally records the 
+ * metrics after each merge.
+ */
+class MetricsCurveVisitor : public RegionMergingVisitor {
+
+public:
+
+	MetricsCurveVisitor(
+			IncrementalEvaluationType& evaluation,
+			std::vector<CurvePoint>* curve = NULL) :
+		_evaluation(evaluation),
+		_curve(curve) {}
+
+	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_evaluation.notifyMerge((c == a ? b : a), c);
+
+		if (_curve)
+			_curve->push_back(CurvePoint(score, _evaluation.metrics()));
+	}
+
+private:
+
+	IncrementalEvaluationType& _evaluation;
+	std::vector<CurvePoint>* _curve;
+};
+
+/**
+ * Records merges as a dendrogram.
+ */
+class DendrogramVisitor : public RegionMergingVisitor {
+
+public:
+
+	DendrogramVisitor(std::vector<DendrogramEntry>& dendrogram) :
+		_dendrogram(dendrogram) {}
+
+	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
+
+		// keep scores sorted, such that the dendrogram can be cut with a 
+		// binary search
+		if (!_dendrogram.empty())
+			score = std::max(score, _dendrogram.back().score);
+
+		_dendrogram.push_back({(c == a ? b : a), c, score});
+	}
 
+private:
+
+	std::vector<DendrogramEntry>& _dendrogram;
+};
+
+/**
+ * Create the statistics provider of the scoring function for the given region 
+ * graph, as done by initialize(). For the stages of initialize() to be run 
+ * separately, see benchmarks/benchmark.cpp.
+ */
+std::shared_ptr<StatisticsProviderType>
+createStatisticsProvider(
+		RegionGraphType&   regionGraph,
+		const std::string& scoringExpression = "");
+
+/**
+ * Create a state from an affinity volume. If the module was compiled with 
+ * DynamicScoringFunction, scoringExpression is the expression to score edges 
+ * with (otherwise it has to be empty).
+ *
+ * If progress is given, the watershed and the extraction of the region graph 
+ * are reported to it. If it gets cancelled, Cancelled is thrown and no state 
+ * is created.
+ */
+WaterzState initialize(
+		size_t             width,
+		size_t             height,
+		size_t             depth,
+		const AffValue*    affinity_data,
+		SegID*             segmentation_data,
+		const GtID*        groundtruth_data = NULL,
+		AffValue           affThresholdLow  = 0.0001,
+		AffValue           affThresholdHigh = 0.9999,
+		bool               findFragments = true,
+		const std::string& scoringExpression = "",
+		ProgressReporter*  progress = NULL);
+
+/**
+ * Same as above, but for affinities quantized to 8 bit. The affinity of an edge 
+ * is given by affinityScale times the stored value. Thresholds are given for 
+ * the scaled affinities.
+ */
+WaterzState initialize(
+		size_t                   width,
+		size_t                   height,
+		size_t                   depth,
+		const QuantizedAffValue* affinity_data,
+		SegID*                   segmentation_data,
+		const GtID*              groundtruth_data = NULL,
+		AffValue                 affThresholdLow  = 0.0001,
+		AffValue                 affThresholdHigh = 0.9999,
+		AffValue                 affinityScale    = 1.0/255,
+		bool                     findFragments = true,
+		const std::string&       scoringExpression = "",
+		ProgressReporter*        progress = NULL);
+
+/**
+ * Create a state from a region graph with precomputed statistics, instead of 
+ * extracting it from a volume. Edge i connects nodes u[i] and v[i], its 
+ * statistics are initialized as if it had contactAreas[i] voxel-level 
+ * affinities of value affinities[i] (quantile providers initialize with a 
+ * single value, as for volumes). Node n is initialized with nodeSizes[n] 
+ * voxels. If contactAreas or nodeSizes are NULL, a contact area and size of 1 
+ * is assumed.
+ *
+ * Node IDs have to be smaller than numNodes. ID 0 is background, edges to it 
+ * are ignored, as are edges from a node to itself. Multiple edges between the 
+ * same nodes are combined into one.
+ *
+ * The state has no segmentation: mergeUntil() returns the merge history only, 
+ * and getDendrogram() can be used as for volumes. Progress is reported and 
+ * cancellation handled as for initialize().
+ */
+WaterzState initializeFromRegionGraph(
+		std::size_t        numNodes,
+		std::size_t        numEdges,
+		const SegID*       u,
+		const SegID*       v,
+		const AffValue*    affinities,
+		const uint64_t*    contactAreas = NULL,
+		const uint64_t*    nodeSizes = NULL,
+		const std::string& scoringExpression = "",
+		ProgressReporter*  progress = NULL);
+
+/**
+ * Merge until the given threshold. Merging stops earlier, if at most 
+ * targetNumSegments segments are left, or a segment of at least maxSegmentSize 
+ * voxels was created (0 disables either criterion). In this case, the state is 
+ * merged until the score of the last merge.
+ *
+ * If progress is given, the initial scoring and the merging are reported to 
+ * it. If it gets cancelled, merging stops early as above (without merging at 
+ * all if cancelled during scoring), such that the state can be saved or 
+ * merged further.
+ */
 std::vector<Merge> mergeUntil(
-		WaterzState& state,
-		float        threshold);
+		WaterzState&      state,
+		float             threshold,
+		std::size_t       targetNumSegments = 0,
+		std::size_t       maxSegmentSize = 0,
+		ProgressReporter* progress = NULL);
+
+/**
+ * Get the counters and timings of the last call to mergeUntil().
+ */
+MergeStatistics getMergeStatistics(WaterzState& state);
+
+/**
+ * Get the wall-clock time and resident memory after each stage of processing
+ * (initialization, scoring, merging, ...) since the previous call. Stages are
+ * logged at LOG_LEVEL_INFO as they finish.
+ */
+std::vector<StageTiming> getStageTimings(WaterzState& state);
+
+/**
+ * Get the current and peak bytes of each component (region graph, statistics 
+ * provider, queue, buffers, ...) since initialization, followed by a 
+ * component "total" with the sum of the current bytes and its peak. The 
+ * volumes passed by the caller are not included.
+ */
+std::vector<ComponentMemory> getMemoryUsage(WaterzState& state);
+
+/**
+ * Estimate the bytes of each component for agglomerating a volume of the 
+ * given size with numFragments fragments (found by the watershed, if 
+ * findFragments is set), in the format of getMemoryUsage(). The peak of 
+ * "total" is the predicted peak of the process, without the volumes passed by 
+ * the caller. The number of edges and contact faces between fragments is 
+ * predicted from their mean size, assuming compact fragments.
+ */
+std::vector<ComponentMemory> estimateMemoryUsage(
+		std::size_t        width,
+		std::size_t        height,
+		std::size_t        depth,
+		std::size_t        numFragments,
+		bool               quantizedAffinities = false,
+		bool               findFragments = true,
+		const std::string& scoringExpression = "");
+
+/**
+ * Merge until each of the given thresholds, and get the metrics compared to the 
+ * ground-truth at each of them. If everyMerge is set, the metrics are recorded 
+ * after every merge instead (with the score of the merge as threshold). The 
+ * segmentation is not extracted. Requires that the state was initialized with 
+ * ground-truth.
+ */
+std::vector<CurvePoint> getMetricsCurve(
+		WaterzState&                   state,
+		const std::vector<ScoreValue>& thresholds,
+		bool                           everyMerge = false);
+
+/**
+ * Merge until all regions are merged, and get the merges as a dendrogram that 
+ * can be cut at any threshold with cutDendrogram(). The segmentation is not 
+ * extracted. Merges that happened before this call are not part of the 
+ * dendrogram, call it right after initialize().
+ */
+std::vector<DendrogramEntry> getDendrogram(WaterzState& state);
 
 std::vector<ScoredEdge> getRegionGraph(WaterzState& state);
 
+/**
+ * Save the complete state of merging (region graph, statistics, queue, merge 
+ * tree, current segmentation, and incremental evaluation) to a file, together 
+ * with the arguments of the agglomeration. The file is written under a 
+ * temporary name first and then renamed, such that an existing checkpoint is 
+ * only replaced by a complete one.
+ */
+void saveCheckpoint(
+		WaterzState&               state,
+		const std::string&         filename,
+		const CheckpointArguments& arguments = CheckpointArguments());
+
+/**
+ * Get the size of the segmentation and the arguments stored in a checkpoint.
+ */
+CheckpointInfo getCheckpointInfo(const std::string& filename);
+
+/**
+ * Restore a state saved with saveCheckpoint(). The checkpoint has to be created 
+ * with the same scoring function, queue, and segment ID type. The current 
+ * segmentation is restored to segmentation_data, which has to be of the size 
+ * given by getCheckpointInfo(), and is used for further merging. For states 
+ * created with initializeFromRegionGraph(), the size is 0 and 
+ * segmentation_data is not used.
+ *
+ * If expected is given, std::invalid_argument is thrown if the size of the 
+ * segmentation, the presence of ground-truth, the scoring expression, or the 
+ * arguments stored in the checkpoint differ from it.
+ */
+WaterzState loadCheckpoint(
+		const std::string&    filename,
+		SegID*                segmentation_data,
+		const CheckpointInfo* expected = NULL);
+
 void free(WaterzState& state);
 
+/**
+ * Agglomerates a batch of independent blocks on a pool of worker threads. Each 
+ * job runs initialize(), mergeUntil() and extractSegmentation() for all its 
+ * thresholds and writes one segmentation per threshold. Completed jobs can be 
+ * collected with next() while the remaining ones are still being processed.
+ */
+class BatchAgglomeration {
+
+public:
+
+	/**
+	 * Create an empty batch. scoringExpression is passed to initialize() for 
+	 * each job.
+	 */
+	BatchAgglomeration(const std::string& scoringExpression = "") :
+		_scoringExpression(scoringExpression),
+		_nextJob(0),
+		_numFinished(0),
+		_numCollected(0),
+		_cancelled(false) {}
+
+	~BatchAgglomeration();
+
+	/**
+	 * Add a job. If fragments_data is NULL, fragments will be found with a 
+	 * watershed. segmentations_data has to hold thresholds.size() volumes, 
+	 * which will be filled with the segmentation for each threshold.
+	 */
+	void addJob(
+			size_t                    width,
+			size_t                    height,
+			size_t                    depth,
+			const AffValue*           affinity_data,
+			const SegID*              fragments_data,
+			SegID*                    segmentations_data,
+			const std::vector<float>& thresholds,
+			AffValue                  affThresholdLow  = 0.0001,
+			AffValue                  affThresholdHigh = 0.9999);
+
+	/**
+	 * Same as above, for affinities quantized to 8 bit.
+	 */
+	void addJob(
+			size_t                    width,
+			size_t                    height,
+			size_t                    depth,
+			const QuantizedAffValue*  affinity_data,
+			const SegID*              fragments_data,
+			SegID*                    segmentations_data,
+			const std::vector<float>& thresholds,
+			AffValue                  affThresholdLow  = 0.0001,
+			AffValue                  affThresholdHigh = 0.9999,
+			AffValue                  affinityScale    = 1.0/255);
+
+	/**
+	 * Start processing the jobs on the given number of threads. If numThreads 
+	 * is 0, one thread per hardware thread is used.
+	 */
+	void start(int numThreads = 0);
+
+	/**
+	 * Wait for the next job to finish and return its index. Returns -1 if all 
+	 * jobs have been collected.
+	 */
+	int next();
+
+	/**
+	 * Check whether a finished job failed, and get the reason.
+	 */
+	bool failed(int job) const { return !_jobs[job].error.empty(); }
+	std::string error(int job) const { return _jobs[job].error; }
+
+private:
+
+	struct Job {
+
+		size_t width;
+		size_t height;
+		size_t depth;
+		const AffValue* affinity_data;
+		const QuantizedAffValue* quantized_affinity_data;
+		const SegID* fragments_data;
+		SegID* segmentations_data;
+		std::vector<float> thresholds;
+		AffValue affThresholdLow;
+		AffValue affThresholdHigh;
+		AffValue affinityScale;
+		std::string error;
+	};
+
+	void work();
+
+	void process(Job& job);
+
+	std::string _scoringExpression;
+
+	std::vector<Job> _jobs;
+	std::vector<std::thread> _workers;
+
+	// index of the next job to be picked up by a worker
+	std::atomic<size_t> _nextJob;
+
+	// finished jobs, in order of completion
+	std::vector<int> _finished;
+	size_t _numFinished;
+	size_t _numCollected;
+	std::mutex _finishedMutex;
+	std::condition_variable _jobFinished;
+
+	std::atomic<bool> _cancelled;
+};
+
 #endif
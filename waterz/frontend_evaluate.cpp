@@ -1,27 +1,8 @@
 #include "frontend_evaluate.h"
 #include "evaluate.hpp"
 
-Metrics
-compare_arrays(
-		std::size_t  width,
-		std::size_t  height,
-		std::size_t  depth,
-		const SegID* gt_data,
-		const SegID* segmentation_data) {
-
-	// wrap gt array (no copy)
-	volume_const_ref<SegID> gt(
-			gt_data,
-			boost::extents[width][height][depth]
-	);
-
-	// wrap segmentation array (no copy)
-	volume_const_ref<SegID> segmentation(
-			segmentation_data,
-			boost::extents[width][height][depth]
-	);
-
-	auto m = compare_volumes(gt, segmentation);
+static Metrics
+toMetrics(const std::tuple<double,double,double,double>& m) {
 
 	Metrics metrics;
 	metrics.rand_split = std::get<0>(m);
@@ -31,3 +12,68 @@ compare_arrays(
 
 	return metrics;
 }
+
+template <typename GtID, typename SegID>
+Metrics
+compare_arrays(
+		std::size_t           width,
+		std::size_t           height,
+		std::size_t           depth,
+		const GtID*           gt_data,
+		const std::ptrdiff_t* gt_strides,
+		const SegID*          segmentation_data,
+		const std::ptrdiff_t* segmentation_strides,
+		int                   num_threads) {
+
+	StreamingEvaluation evaluation(num_threads);
+	evaluation.add(
+			width, height, depth,
+			gt_data, gt_strides,
+			segmentation_data, segmentation_strides);
+
+	return evaluation.metrics();
+}
+
+template <typename GtID, typename SegID>
+void
+StreamingEvaluation::add(
+		std::size_t           width,
+		std::size_t           height,
+		std::size_t           depth,
+		const GtID*           gt_data,
+		const std::ptrdiff_t* gt_strides,
+		const SegID*          segmentation_data,
+		const std::ptrdiff_t* segmentation_strides) {
+
+	std::size_t shape[] = {width, height, depth};
+
+	// number of co-occurences of label i and j, ignoring background in gt
+	accumulate_contingency(
+			_p_ij,
+			gt_data, gt_strides,
+			segmentation_data, segmentation_strides,
+			shape,
+			_numThreads);
+}
+
+Metrics
+StreamingEvaluation::metrics() const {
+
+	return toMetrics(contingency_metrics(_p_ij));
+}
+
+#define WATERZ_INSTANTIATE_EVALUATE(GtID, SegID) \
+	template Metrics compare_arrays<GtID, SegID>( \
+			std::size_t, std::size_t, std::size_t, \
+			const GtID*, const std::ptrdiff_t*, \
+			const SegID*, const std::ptrdiff_t*, \
+			int); \
+	template void StreamingEvaluation::add<GtID, SegID>( \
+			std::size_t, std::size_t, std::size_t, \
+			const GtID*, const std::ptrdiff_t*, \
+			const SegID*, const std::ptrdiff_t*);
+
+WATERZ_INSTANTIATE_EVALUATE(uint32_t, uint32_t)
+WATERZ_INSTANTIATE_EVALUATE(uint32_t, uint64_t)
+WATERZ_INSTANTIATE_EVALUATE(uint64_t, uint32_t)
+WATERZ_INSTANTIATE_EVALUATE(uint64_t, uint64_t)
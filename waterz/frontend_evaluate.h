@@ -1,9 +1,9 @@
 #ifndef C_EVALUATE_H
 #define C_EVALUATE_H
 
+#include <cstddef>
 #include "backend/types.hpp"
-
-typedef uint64_t SegID;
+#include "backend/ContingencyTable.hpp"
 
 struct Metrics {
 
@@ -13,13 +13,58 @@ struct Metrics {
 	double rand_merge;
 };
 
+/**
+ * Compare a 3D segmentation against ground-truth. The arrays are read with the 
+ * given strides (in elements), such that views into larger arrays can be 
+ * evaluated without copying them. Instantiated for uint32_t and uint64_t 
+ * labels in either array.
+ */
+template <typename GtID, typename SegID>
 Metrics
 compare_arrays(
-		std::size_t  width,
-		std::size_t  height,
-		std::size_t  depth,
-		const SegID* gt_data,
-		const SegID* segmentation_data);
+		std::size_t           width,
+		std::size_t           height,
+		std::size_t           depth,
+		const GtID*           gt_data,
+		const std::ptrdiff_t* gt_strides,
+		const SegID*          segmentation_data,
+		const std::ptrdiff_t* segmentation_strides,
+		int                   num_threads = 0);
 
-#endif
+/**
+ * Accumulates the contingency table of ground-truth and segmentation chunk by 
+ * chunk, for volumes that do not fit into memory.
+ */
+class StreamingEvaluation {
+
+public:
+
+	StreamingEvaluation(int num_threads = 0) :
+		_numThreads(num_threads) {}
+
+	/**
+	 * Add a 3D chunk of ground-truth and segmentation, see compare_arrays() 
+	 * for the supported label types and strides.
+	 */
+	template <typename GtID, typename SegID>
+	void add(
+			std::size_t           width,
+			std::size_t           height,
+			std::size_t           depth,
+			const GtID*           gt_data,
+			const std::ptrdiff_t* gt_strides,
+			const SegID*          segmentation_data,
+			const std::ptrdiff_t* segmentation_strides);
 
+	/**
+	 * Get the metrics over all chunks added so far.
+	 */
+	Metrics metrics() const;
+
+private:
+
+	ContingencyTable _p_ij;
+	int _numThreads;
+};
+
+#endif
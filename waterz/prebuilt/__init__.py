@@ -0,0 +1,62 @@
+'''
+Agglomeration modules that are compiled when waterz is installed, such that the
+common configurations do not have to be compiled on first use.
+
+This file is read by setup.py (without importing waterz), which builds one
+module per configuration in PREBUILT. _get_module() in waterz/__init__.py
+imports them from here before it falls back to compiling a module.
+'''
+
+import hashlib
+
+# the scoring functions to prebuild, including the one of scoring_engine='runtime'
+SCORING_FUNCTIONS = [
+    'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+    'OneMinus<HistogramQuantileAffinity<RegionGraphType, 50, ScoreValue, 256>>',
+    'OneMinus<HistogramQuantileAffinity<RegionGraphType, 75, ScoreValue, 256>>',
+    'DynamicScoringFunction<RegionGraphType, ScoreValue>',
+]
+
+DISCRETIZE_QUEUES = [0, 256]
+
+SEGMENT_ID_TYPES = ['uint64', 'uint32']
+
+def normalize_scoring_function(scoring_function):
+    '''
+    Remove all whitespace, such that e.g. 'A<B<C> >' and 'A<B<C>>' are found to
+    be the same scoring function.
+    '''
+
+    return ''.join(scoring_function.split())
+
+def module_name(scoring_function, discretize_queue, segment_id_type):
+    '''
+    Get the name of the prebuilt module for the given configuration, which is
+    not necessarily part of PREBUILT.
+    '''
+
+    key = normalize_scoring_function(scoring_function), int(discretize_queue), segment_id_type
+    return 'agglomerate_' + hashlib.md5(str(key).encode('utf-8')).hexdigest()[:16]
+
+PREBUILT = {
+    (normalize_scoring_function(s), q, t): module_name(s, q, t)
+    for s in SCORING_FUNCTIONS
+    for q in DISCRETIZE_QUEUES
+    for t in SEGMENT_ID_TYPES
+}
+
+def find_module(scoring_function, discretize_queue, segment_id_type):
+    '''
+    Import the prebuilt module for the given configuration. Returns None if
+    there is none, or if it was not built with this installation.
+    '''
+
+    key = normalize_scoring_function(scoring_function), int(discretize_queue), segment_id_type
+    if key not in PREBUILT:
+        return None
+
+    import importlib
+    try:
+        return importlib.import_module(__name__ + '.' + PREBUILT[key])
+    except ImportError:
+        return None